@@ -0,0 +1,310 @@
+/* Times the dictionary operations on the bundled word files.
+   Built against t27.c as 'bench' and against ext.c (with -DEXT)
+   as 'bench_ext', so the two backends run the same workload.
+
+   Every op is run once to warm up, then REPEATS more times. Ops
+   are timed in batches of BATCH, each batch giving one sample of
+   ns per op; building and freeing are per word. Prints one CSV
+   line per op: corpus,backend,op,unit,median,p99,samples, and
+   the peak resident memory that building the dictionary adds.
+   Each corpus runs in a process of its own, so that is neither
+   the word lists nor what an earlier corpus left behind. */
+
+// clock_gettime, getrusage and fork are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+#ifdef EXT
+#include "ext.h"
+#define BACKEND "hash"
+#else
+#include "t27.h"
+#define BACKEND "trie"
+#endif
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DICTFILES 3
+#define MAXSTR 50
+#define WARMUP 1
+#define REPEATS 7
+#define BATCH 64
+#define TOPN 10
+#define TOPN_CALLS 1000
+
+// All the words of one file, each with a copy that misses
+typedef struct wordlist {
+   char* text;    // The words, back to back
+   char** word;
+   char** miss;   // Each word with an extra 'q', mostly not a word
+   char** pre;    // The first (up to) 3 letters of each word
+   int n;
+} wordlist;
+
+// Each word's three strings, in one slot of 'text'
+#define WORD_SLOT (3 * (MAXSTR + 1))
+
+// Samples of ns per op, for one op on one corpus
+typedef struct samples {
+   double* ns;
+   int n;
+   int cap;
+   bool keep;     // False during warm-up
+} samples;
+
+enum {
+   OP_INSERT, OP_SPELL_HIT, OP_SPELL_MISS, OP_SPELL_BATCH, OP_AUTOCOMPLETE,
+   OP_WORDCOUNT, OP_NODECOUNT, OP_MOSTCOMMON, OP_TOPN, OP_FREE,
+   OP_WRITER_ADD, OP_WRITER_CLOSE, OP_DA_BUILD, OP_DA_HIT, OP_DA_MISS,
+   NOPS
+};
+
+// Name of each op in the CSV, and the backend it is reported under
+static const char* op_name[NOPS] = {
+   "insert", "spell_hit", "spell_miss", "spell_batch", "autocomplete",
+   "wordcount", "nodecount", "mostcommon", "topn", "free",
+   "writer_add", "writer_close", "build", "spell_hit", "spell_miss"
+};
+static const char* op_backend[NOPS] = {
+   BACKEND, BACKEND, BACKEND, BACKEND, BACKEND,
+   BACKEND, BACKEND, BACKEND, BACKEND, BACKEND,
+   BACKEND, BACKEND, "double_array", "double_array", "double_array"
+};
+
+static double now_ns(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+static wordlist read_words(const char* fname)
+{
+   wordlist wl = {NULL, NULL, NULL, NULL, 0};
+   FILE* fp = fopen(fname, "rt");
+   if (!fp) {
+      fprintf(stderr, "Cannot open word file %s?\n", fname);
+      exit(EXIT_FAILURE);
+   }
+   int cap = 1024;
+   char str[MAXSTR];
+   wl.text = (char*)malloc((size_t)cap * WORD_SLOT);
+   while (fgets(str, MAXSTR, fp) != NULL) {
+      char str2[MAXSTR];
+      if (sscanf(str, "%s", str2) != 1) {
+         continue;
+      }
+      if (wl.n == cap) {
+         cap *= 2;
+         wl.text = (char*)realloc(wl.text, (size_t)cap * WORD_SLOT);
+      }
+      if (!wl.text) {
+         fprintf(stderr, "Memory allocation failed in read_words\n");
+         exit(EXIT_FAILURE);
+      }
+      char* w = wl.text + (size_t)wl.n * WORD_SLOT;
+      strcpy(w, str2);
+      sprintf(w + MAXSTR + 1, "%sq", str2);
+      sprintf(w + 2 * (MAXSTR + 1), "%.3s", str2);
+      wl.n++;
+   }
+   fclose(fp);
+
+   // Point at the words once the buffer has stopped moving
+   wl.word = (char**)malloc((size_t)wl.n * sizeof(char*));
+   wl.miss = (char**)malloc((size_t)wl.n * sizeof(char*));
+   wl.pre = (char**)malloc((size_t)wl.n * sizeof(char*));
+   if (!wl.word || !wl.miss || !wl.pre) {
+      fprintf(stderr, "Memory allocation failed in read_words\n");
+      exit(EXIT_FAILURE);
+   }
+   for (int i = 0; i < wl.n; i++) {
+      wl.word[i] = wl.text + (size_t)i * WORD_SLOT;
+      wl.miss[i] = wl.word[i] + MAXSTR + 1;
+      wl.pre[i] = wl.word[i] + 2 * (MAXSTR + 1);
+   }
+   return wl;
+}
+
+static void free_words(wordlist* wl)
+{
+   free(wl->text);
+   free(wl->word);
+   free(wl->miss);
+   free(wl->pre);
+}
+
+static void sample_add(samples* s, double ns_per_op)
+{
+   if (!s->keep) {
+      return;
+   }
+   if (s->n == s->cap) {
+      s->cap = s->cap ? s->cap * 2 : 256;
+      s->ns = (double*)realloc(s->ns, (size_t)s->cap * sizeof(double));
+      if (!s->ns) {
+         fprintf(stderr, "Memory allocation failed in sample_add\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   s->ns[s->n++] = ns_per_op;
+}
+
+/* Runs 'stmt' for each i in [0, n), timing it in batches of
+   BATCH: each batch adds its ns per op to samples s. */
+#define TIME_BATCHES(s, n, stmt)                                \
+   for (int b_ = 0; b_ < (n); b_ += BATCH) {                    \
+      int e_ = b_ + BATCH < (n) ? b_ + BATCH : (n);             \
+      double t0_ = now_ns();                                    \
+      for (int i = b_; i < e_; i++) {                           \
+         stmt;                                                  \
+      }                                                         \
+      sample_add(s, (now_ns() - t0_) / (e_ - b_));              \
+   }
+
+static int cmp_double(const void* a, const void* b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+// Prints the median and 99th percentile of s (if it has any), and empties it
+static void report(const char* corpus, int op, samples* s)
+{
+   if (s->n == 0) {
+      return;
+   }
+   qsort(s->ns, (size_t)s->n, sizeof(double), cmp_double);
+   int p99 = (int)((double)(s->n - 1) * 0.99 + 0.5);
+   printf("%s,%s,%s,ns_per_op,%.2f,%.2f,%d\n", corpus, op_backend[op], op_name[op],
+          s->ns[(s->n - 1) / 2], s->ns[p99], s->n);
+   s->n = 0;
+}
+
+static long peak_rss_kb(void)
+{
+   struct rusage ru;
+   getrusage(RUSAGE_SELF, &ru);
+   return ru.ru_maxrss;
+}
+
+// Runs every op on the words of file 'fname', printing the results
+static void bench_corpus(const char* fname)
+{
+   // Stops the compiler dropping lookups whose result is unused
+   volatile unsigned sink = 0;
+   samples s[NOPS];
+   memset(s, 0, sizeof(s));
+
+   wordlist wl = read_words(fname);
+   dict** got = (dict**)malloc((size_t)wl.n * sizeof(dict*));
+   char topbuf[TOPN][256];
+   char* topw[TOPN];
+   int topf[TOPN];
+   if (!got) {
+      fprintf(stderr, "Memory allocation failed in bench_corpus\n");
+      exit(EXIT_FAILURE);
+   }
+   for (int i = 0; i < TOPN; i++) {
+      topw[i] = topbuf[i];
+   }
+
+   // What one dictionary of these words adds to the peak, before anything else is built
+   long rss0 = peak_rss_kb();
+   dict* first = dict_init();
+   for (int i = 0; i < wl.n; i++) {
+      dict_addword(first, wl.word[i]);
+   }
+   long rss = peak_rss_kb() - rss0;
+   dict_free(&first);
+
+   for (int r = 0; r < WARMUP + REPEATS; r++) {
+      for (int op = 0; op < NOPS; op++) {
+         s[op].keep = r >= WARMUP;
+      }
+
+      double t0;
+      dict* d = dict_init();
+      TIME_BATCHES(&s[OP_INSERT], wl.n, dict_addword(d, wl.word[i]));
+#ifdef EXT
+      if (r == 0) {
+         // How well the hash spreads this corpus, kept off the CSV
+         fprintf(stderr, "%s: ", fname);
+         dict_probe_report(d, stderr);
+      }
+#endif
+      TIME_BATCHES(&s[OP_SPELL_HIT], wl.n, sink += dict_spell(d, wl.word[i]) != NULL);
+      TIME_BATCHES(&s[OP_SPELL_MISS], wl.n, sink += dict_spell(d, wl.miss[i]) != NULL);
+      // The same hits, a batch per call
+      for (int b = 0; b < wl.n; b += BATCH) {
+         int e = b + BATCH < wl.n ? b + BATCH : wl.n;
+         t0 = now_ns();
+         dict_spell_batch(d, (const char* const*)wl.word + b, e - b, got + b);
+         sample_add(&s[OP_SPELL_BATCH], (now_ns() - t0) / (e - b));
+      }
+      TIME_BATCHES(&s[OP_WORDCOUNT], wl.n, sink += dict_wordcount(d));
+      TIME_BATCHES(&s[OP_MOSTCOMMON], wl.n, sink += dict_mostcommon(d));
+      TIME_BATCHES(&s[OP_TOPN], TOPN_CALLS, sink += dict_topn(d, TOPN, topw, topf));
+#ifndef EXT
+      char ret[256];
+      TIME_BATCHES(&s[OP_AUTOCOMPLETE], wl.n, dict_autocomplete(d, wl.pre[i], ret); sink += ret[0]);
+      TIME_BATCHES(&s[OP_NODECOUNT], wl.n, sink += dict_nodecount(d));
+
+      // The double array, built from the finished tree
+      t0 = now_ns();
+      dict_da* a = dict_da_build(d);
+      sample_add(&s[OP_DA_BUILD], (now_ns() - t0) / wl.n);
+      TIME_BATCHES(&s[OP_DA_HIT], wl.n, sink += dict_da_spell(a, wl.word[i]));
+      TIME_BATCHES(&s[OP_DA_MISS], wl.n, sink += dict_da_spell(a, wl.miss[i]));
+      dict_da_free(&a);
+
+      // The same words through a dict_writer (on this one thread)
+      dict* wd = dict_init();
+      dict_writer* w = dict_writer_new(wd);
+      TIME_BATCHES(&s[OP_WRITER_ADD], wl.n, dict_writer_add(w, wl.word[i]));
+      t0 = now_ns();
+      dict_writer_free(&w);
+      sample_add(&s[OP_WRITER_CLOSE], (now_ns() - t0) / wl.n);
+      sink += dict_nodecount(wd) != dict_nodecount(d);
+      dict_free(&wd);
+#endif
+
+      t0 = now_ns();
+      dict_free(&d);
+      sample_add(&s[OP_FREE], (now_ns() - t0) / wl.n);
+   }
+
+   for (int op = 0; op < NOPS; op++) {
+      report(fname, op, &s[op]);
+      free(s[op].ns);
+   }
+   printf("%s,%s,peak_rss,kb,%ld,%ld,1\n", fname, BACKEND, rss, rss);
+   free(got);
+   free_words(&wl);
+}
+
+int main(void)
+{
+   char dictnames[DICTFILES][MAXSTR] = {"wordle.txt", "p-and-p-words.txt", "english_65197.txt"};
+
+   printf("corpus,backend,op,unit,median,p99,samples\n");
+   fflush(stdout);
+   for (int f = 0; f < DICTFILES; f++) {
+      // A fresh process per corpus, so its memory is measured alone
+      pid_t pid = fork();
+      if (pid < 0) {
+         fprintf(stderr, "Cannot fork in main\n");
+         exit(EXIT_FAILURE);
+      }
+      if (pid == 0) {
+         bench_corpus(dictnames[f]);
+         exit(EXIT_SUCCESS);
+      }
+      int status;
+      if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+         return EXIT_FAILURE;
+      }
+   }
+   return EXIT_SUCCESS;
+}
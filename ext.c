@@ -1,32 +1,262 @@
+// mmap and clock_gettime are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
 #include "ext.h"
+#include "norm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-#define HASH_TABLE_SIZE 10007 // A prime number for hash table size
-#define BUFFER_SIZE 256       // Maximum word size
+#define TABLE_MIN 16    // Slots in a new table, a power of two
+#define MIGRATE_STEP 4  // Old slots moved per new word while a resize runs
+#define BATCH_LANES 16  // Lookups in flight at once in dict_spell_batch
+#define INLINE_KEY 14   // Words this long or shorter are kept in their slot
+#define CHUNK_BITS 12   // Entries (and places in the order) per chunk: 4096
+#define ARENA_BITS 16   // Bytes per chunk of the string arena: 64 KiB
 
-// Structure for hash table node
-typedef struct HashNode {
-   char* word;            // The word stored in this node
-   int freq;              // Frequency of the word
-   struct HashNode* next; // Pointer to the next node (chaining for collisions)
-} HashNode;
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
 
-// Structure for hash table
+/* One slot of the table (24 bytes), empty while len is 0. Every
+   word is in the string arena, where dict_topn copies it from,
+   since slots move; one of up to INLINE_KEY letters is kept in
+   the slot as well, so that comparing it fetches nothing more.
+   For a longer one the slot holds its arena offset instead. */
+typedef struct HashSlot {
+   unsigned int hash;        // Full hash of the word, checked first
+   uint32_t id;              // Number of the word, in order added
+   unsigned char len;        // Length of the word
+   char key[INLINE_KEY + 1]; // The word, or its uint32_t arena offset
+} HashSlot;
+
+// What is kept for each word, by id: unlike slots, these never move
+typedef struct HashEntry {
+   int freq;                 // Frequency of the word
+   int rank;                 // Its place in the most-frequent-first order
+   uint32_t text;            // Offset of the word in the string arena
+} HashEntry;
+
+/* Open addressing with Robin Hood placement: a word lives at or
+   after its home slot, and a word further from home takes the
+   place of one nearer to it. So a search can stop at the first
+   slot whose word is nearer home than the search has come. */
+typedef struct SlotTable {
+   HashSlot* slot;      // NULL if the table isn't in use
+   unsigned int mask;   // Number of slots - 1
+   int shift;           // 32 - log2(slots), to find a home slot
+} SlotTable;
+
+/* Structure for hash table. Growing it doubles 'cur' and keeps
+   the old slots in 'old', moving a few across with each new word
+   rather than all at once. Lookups check both until it's empty.
+   The per-word arrays and the string arena grow a fixed-size chunk
+   at a time instead, so nothing already added is ever copied:
+   only their small tables of chunk pointers are reallocated. */
 typedef struct HashTable {
-   HashNode* table[HASH_TABLE_SIZE]; // Array of pointers to hash nodes
+   SlotTable cur;         // Where new words go
+   SlotTable old;         // The table being emptied into cur, if any
+   unsigned int drained;  // Slots of 'old' moved so far
+   char** arena;          // Every word, back to back and terminated
+   int arena_chunks;      // Chunks of the arena, the last one in use
+   int arena_cap;
+   size_t arena_used;     // Bytes used in the last chunk
+   HashEntry** entry;     // Indexed by id, 'count' of them
+   /* Word ids, most frequent first: order[i] has rank i, and the
+      first above[f] of them have frequency greater than f. */
+   int** order;
+   int chunks;            // Chunks of 'entry', and of 'order'
+   int chunk_cap;
+   int* above;            // Indexed 0 .. maxfreq
+   int above_cap;
+   uint64_t seed;         // Random per table, so hashes can't be predicted
+   int count;             // Distinct words
+   int words;             // Sum of all frequencies
+   int maxfreq;           // Frequency of the most common word
 } HashTable;
 
-// Hash function to calculate index
-static unsigned int hash_function(const char* word) {
-   unsigned int hash = 0;
-   while (*word) {
-      hash = (hash * 31) + tolower(*word);
-      word++;
+// Odd constants of the hash, with bits spread evenly
+#define HASH_K0 0xa0761d6478bd642full
+#define HASH_K1 0xe7037ed1a0b428dbull
+#define HASH_K2 0x8ebc6af09c88c6e3ull
+
+// Folds every letter to lowercase; leaves ' (0x27) and padding alike
+#define HASH_FOLD 0x2020202020202020ull
+
+// Multiplies a by b into 128 bits and folds the halves together
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+   __extension__ typedef unsigned __int128 u128;
+   u128 r = (u128)a * b;
+   return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+   uint64_t lo = (a & 0xffffffffu) * (b & 0xffffffffu);
+   uint64_t mid = (a >> 32) * (b & 0xffffffffu) + (a & 0xffffffffu) * (b >> 32);
+   uint64_t hi = (a >> 32) * (b >> 32);
+   return (lo + (mid << 32)) ^ (hi + (mid >> 32));
+#endif
+}
+
+// Up to 8 characters from w, in one word, zero padded and case folded
+static inline uint64_t hash_load(const char* w, size_t n) {
+   uint64_t v = 0;
+   memcpy(&v, w, n < 8 ? n : 8);
+   return v | HASH_FOLD;
+}
+
+/* Hash of the 'len' characters at w (a checked word, in any case),
+   16 at a time with one 64x64->128 multiply each, in the manner of
+   wyhash. The seed makes collisions depend on the table. */
+static unsigned int hash_function(uint64_t seed, const char* w, size_t len) {
+   uint64_t h = seed ^ hash_mix(len ^ HASH_K0, HASH_K1);
+   size_t i = 0;
+   for (; i + 16 <= len; i += 16) {
+      h = hash_mix(hash_load(w + i, 8) ^ HASH_K1, hash_load(w + i + 8, 8) ^ h);
+   }
+   if (i < len) {
+      size_t n = len - i;
+      uint64_t a = hash_load(w + i, n);
+      uint64_t b = n > 8 ? hash_load(w + i + 8, n - 8) : HASH_FOLD;
+      h = hash_mix(a ^ HASH_K1, b ^ h);
+   }
+   h = hash_mix(h ^ HASH_K2, h ^ HASH_K0);
+   return (unsigned int)(h ^ (h >> 32));
+}
+
+// A seed no one outside can guess: from the system, else the clock
+static uint64_t hash_seed(const void* salt) {
+   uint64_t seed = 0;
+   int fd = open("/dev/urandom", O_RDONLY);
+   if (fd >= 0) {
+      if (read(fd, &seed, sizeof(seed)) != (ssize_t)sizeof(seed)) {
+         seed = 0;
+      }
+      close(fd);
+   }
+   if (seed == 0) {
+      struct timespec t;
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      seed = hash_mix((uint64_t)t.tv_sec ^ HASH_K0, (uint64_t)t.tv_nsec ^ (uint64_t)(uintptr_t)salt);
+   }
+   return seed;
+}
+
+// Home slot of a hash: its top bits
+static inline unsigned int home_slot(const SlotTable* t, unsigned int hash) {
+   return hash >> t->shift;
+}
+
+// How far the word in slot pos is from its home
+static inline unsigned int slot_dist(const SlotTable* t, unsigned int pos) {
+   return (pos - home_slot(t, t->slot[pos].hash)) & t->mask;
+}
+
+// Give t 2^bits empty slots
+static void table_alloc(SlotTable* t, int bits) {
+   t->slot = (HashSlot*)calloc((size_t)1 << bits, sizeof(HashSlot));
+   if (!t->slot) {
+      fprintf(stderr, "Memory allocation failed in dict_addword\n");
+      exit(EXIT_FAILURE);
+   }
+   t->mask = (1u << bits) - 1;
+   t->shift = 32 - bits;
+}
+
+// Entry of word 'id'
+static inline HashEntry* entry_of(const HashTable* ht, int id) {
+   return &ht->entry[id >> CHUNK_BITS][id & ((1 << CHUNK_BITS) - 1)];
+}
+
+// Place i of the most-frequent-first order
+static inline int* order_at(const HashTable* ht, int i) {
+   return &ht->order[i >> CHUNK_BITS][i & ((1 << CHUNK_BITS) - 1)];
+}
+
+// The word at offset 'off' of the arena
+static inline const char* arena_at(const HashTable* ht, uint32_t off) {
+   return ht->arena[off >> ARENA_BITS] + (off & ((1u << ARENA_BITS) - 1));
+}
+
+// The characters of the word in slot s
+static inline const char* slot_key(const HashTable* ht, const HashSlot* s) {
+   if (s->len <= INLINE_KEY) {
+      return s->key;
+   }
+   uint32_t off;
+   memcpy(&off, s->key, sizeof(off));
+   return arena_at(ht, off);
+}
+
+// The slot holding the 'len' characters w (with hash 'hash') in t, or NULL
+static HashSlot* table_find(const HashTable* ht, const SlotTable* t, const char* w, size_t len, unsigned int hash) {
+   if (!t->slot) {
+      return NULL;
+   }
+   unsigned int pos = home_slot(t, hash);
+   for (unsigned int dist = 0;; dist++, pos = (pos + 1) & t->mask) {
+      HashSlot* s = &t->slot[pos];
+      if (!s->len || slot_dist(t, pos) < dist) {
+         return NULL; // Empty, or w would have displaced this one
+      }
+      // The hash and length rule out nearly every other word unread
+      if (s->hash == hash && s->len == len && memcmp(slot_key(ht, s), w, len) == 0) {
+         return s;
+      }
+   }
+}
+
+// Put e (not already in t) into t, which must have a free slot
+static void table_put(SlotTable* t, HashSlot e) {
+   unsigned int pos = home_slot(t, e.hash);
+   for (unsigned int dist = 0;; dist++, pos = (pos + 1) & t->mask) {
+      HashSlot* s = &t->slot[pos];
+      if (!s->len) {
+         *s = e;
+         return;
+      }
+      // Take the slot of a word nearer home, and carry that one on
+      unsigned int d = slot_dist(t, pos);
+      if (d < dist) {
+         HashSlot tmp = *s;
+         *s = e;
+         e = tmp;
+         dist = d;
+      }
+   }
+}
+
+// Move up to 'steps' slots of the old table across to the current one
+static void migrate(HashTable* ht, unsigned int steps) {
+   unsigned int size = ht->old.mask + 1;
+   while (steps-- > 0 && ht->drained < size) {
+      HashSlot* s = &ht->old.slot[ht->drained++];
+      if (s->len) {
+         table_put(&ht->cur, *s);
+      }
+   }
+   if (ht->drained == size) {
+      free(ht->old.slot);
+      ht->old.slot = NULL;
    }
-   return hash % HASH_TABLE_SIZE;
+}
+
+/* Start a resize: the current table becomes the old one, and new
+   words go to one twice the size. At MIGRATE_STEP slots per word,
+   the old table is empty long before the new one needs to grow. */
+static void grow(HashTable* ht) {
+   if (ht->old.slot) {
+      migrate(ht, ht->old.mask + 1); // Not reached in practice
+   }
+   ht->old = ht->cur;
+   ht->drained = 0;
+   table_alloc(&ht->cur, 33 - ht->old.shift);
 }
 
 // Initialize the hash table
@@ -36,46 +266,228 @@ dict* dict_init(void) {
       fprintf(stderr, "Memory allocation failed in dict_init\n");
       exit(EXIT_FAILURE);
    }
+   int bits = 0;
+   while ((1 << bits) < TABLE_MIN) {
+      bits++;
+   }
+   table_alloc(&ht->cur, bits);
+   ht->seed = hash_seed(ht);
    return (dict*)ht;
 }
 
+// The slot of a lowercased word, in either table, or NULL
+static HashSlot* lookup(const HashTable* ht, const char* lower_word, size_t len, unsigned int hash) {
+   HashSlot* s = table_find(ht, &ht->cur, lower_word, len, hash);
+   return s ? s : table_find(ht, &ht->old, lower_word, len, hash);
+}
+
+// Room for one more chunk pointer in *chunk (of *cap)
+static void chunk_room(void*** chunk, int n, int* cap) {
+   if (n < *cap) {
+      return;
+   }
+   *cap = *cap ? *cap * 2 : 16;
+   *chunk = (void**)realloc(*chunk, (size_t)*cap * sizeof(void*));
+   if (!*chunk) {
+      fprintf(stderr, "Memory allocation failed in dict_addword\n");
+      exit(EXIT_FAILURE);
+   }
+}
+
+// Copy a word to the end of the arena, returning its offset
+static uint32_t arena_add(HashTable* ht, const char* w, size_t len) {
+   // A word never spans two chunks: one that doesn't fit starts the next
+   if (!ht->arena_chunks || ht->arena_used + len + 1 > ((size_t)1 << ARENA_BITS)) {
+      chunk_room((void***)&ht->arena, ht->arena_chunks, &ht->arena_cap);
+      char* c = (char*)malloc((size_t)1 << ARENA_BITS);
+      if (!c || ht->arena_chunks == 1 << (32 - ARENA_BITS)) {
+         fprintf(stderr, "Memory allocation failed in dict_addword\n");
+         exit(EXIT_FAILURE);
+      }
+      ht->arena[ht->arena_chunks++] = c;
+      ht->arena_used = 0;
+   }
+   uint32_t off = ((uint32_t)(ht->arena_chunks - 1) << ARENA_BITS) | (uint32_t)ht->arena_used;
+   memcpy(ht->arena[ht->arena_chunks - 1] + ht->arena_used, w, len + 1);
+   ht->arena_used += len + 1;
+   return off;
+}
+
+// Make sure above[0 .. f] exist, new entries zero
+static void above_grow(HashTable* ht, int f) {
+   if (f < ht->above_cap) {
+      return;
+   }
+   int cap = ht->above_cap ? ht->above_cap : 16;
+   while (cap <= f) {
+      cap *= 2;
+   }
+   ht->above = (int*)realloc(ht->above, (size_t)cap * sizeof(int));
+   if (!ht->above) {
+      fprintf(stderr, "Memory allocation failed in dict_addword\n");
+      exit(EXIT_FAILURE);
+   }
+   memset(ht->above + ht->above_cap, 0, (size_t)(cap - ht->above_cap) * sizeof(int));
+   ht->above_cap = cap;
+}
+
+/* Word id's frequency has just gone from f to f + 1: swap it with
+   the first word of frequency f, moving the boundary above f on
+   by one. The order stays sorted at O(1) per word added. */
+static void order_bump(HashTable* ht, int id, int f) {
+   above_grow(ht, f + 1);
+   int j = ht->above[f];
+   int other = *order_at(ht, j);
+   int r = entry_of(ht, id)->rank;
+   *order_at(ht, r) = other;
+   entry_of(ht, other)->rank = r;
+   *order_at(ht, j) = id;
+   entry_of(ht, id)->rank = j;
+   ht->above[f]++;
+}
+
+// Add a word, already checked and lowercased, to the hash table
+static bool add_lower(HashTable* ht, const char* lower_word, size_t len) {
+   unsigned int hash = hash_function(ht->seed, lower_word, len);
+   HashSlot* s = lookup(ht, lower_word, len, hash);
+   ht->words++;
+   if (s) {
+      HashEntry* en = entry_of(ht, (int)s->id);
+      order_bump(ht, (int)s->id, en->freq);
+      en->freq++; // Increment frequency if found
+      if (en->freq > ht->maxfreq) {
+         ht->maxfreq = en->freq;
+      }
+      return false; // Word already exists
+   }
+
+   // Keep the current table at most 3/4 full
+   if ((size_t)(ht->count + 1) * 4 > ((size_t)ht->cur.mask + 1) * 3) {
+      grow(ht);
+   }
+   if (ht->count == ht->chunks << CHUNK_BITS) {
+      int cap = ht->chunk_cap;
+      chunk_room((void***)&ht->entry, ht->chunks, &cap);
+      chunk_room((void***)&ht->order, ht->chunks, &ht->chunk_cap);
+      ht->entry[ht->chunks] = (HashEntry*)malloc(sizeof(HashEntry) << CHUNK_BITS);
+      ht->order[ht->chunks] = (int*)malloc(sizeof(int) << CHUNK_BITS);
+      if (!ht->entry[ht->chunks] || !ht->order[ht->chunks]) {
+         fprintf(stderr, "Memory allocation failed in dict_addword\n");
+         exit(EXIT_FAILURE);
+      }
+      ht->chunks++;
+   }
+   int id = ht->count;
+   HashEntry* en = entry_of(ht, id);
+   en->freq = 1;
+   en->text = arena_add(ht, lower_word, len);
+
+   // New words have the lowest frequency, so go last in the order
+   above_grow(ht, 1);
+   en->rank = id;
+   *order_at(ht, id) = id;
+   ht->above[0]++;
+
+   HashSlot e = {hash, (uint32_t)id, (unsigned char)len, {0}};
+   if (len <= INLINE_KEY) {
+      memcpy(e.key, lower_word, len);
+   } else {
+      memcpy(e.key, &en->text, sizeof(en->text));
+   }
+   table_put(&ht->cur, e);
+   ht->count++;
+   if (ht->maxfreq < 1) {
+      ht->maxfreq = 1;
+   }
+   if (ht->old.slot) {
+      migrate(ht, MIGRATE_STEP);
+   }
+
+   return true; // Successfully added a new word
+}
+
+// Add the 'len' characters at wd to the hash table
+static bool addword_n(HashTable* ht, const char* wd, size_t len) {
+   char lower_word[WORD_MAXLEN + 1];
+   if (!norm_word(wd, len, lower_word, NULL)) {
+      return false; // Not a word, or too long
+   }
+   return add_lower(ht, lower_word, len);
+}
+
 // Add a word to the hash table
 bool dict_addword(dict* p, const char* wd) {
    if (!p || !wd || !*wd) {
       return false; // Invalid input
    }
+   return addword_n((HashTable*)p, wd, strlen(wd));
+}
 
-   HashTable* ht = (HashTable*)p;
-   char lower_word[BUFFER_SIZE];
-   for (int i = 0; wd[i] != '\0'; i++) {
-      lower_word[i] = tolower(wd[i]);
+// Whitespace separating the words of a word file
+static bool is_blank(char c) {
+   return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+// Add every word of a file, read in place through mmap
+int dict_load_file(dict* p, const char* fname, int* rejected) {
+   if (rejected) {
+      *rejected = 0;
+   }
+   if (!p || !fname) {
+      return -1;
    }
-   lower_word[strlen(wd)] = '\0';
 
-   unsigned int index = hash_function(lower_word);
-   HashNode* current = ht->table[index];
+   int fd = open(fname, O_RDONLY);
+   if (fd < 0) {
+      return -1;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      close(fd);
+      return -1;
+   }
+   size_t size = (size_t)st.st_size;
+   if (size == 0) {
+      close(fd);
+      return 0;
+   }
+   const char* text = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (text == MAP_FAILED) {
+      return -1;
+   }
+   posix_madvise((void*)text, size, POSIX_MADV_SEQUENTIAL);
 
-   // Search for the word in the chain
-   while (current) {
-      if (strcmp(current->word, lower_word) == 0) {
-         current->freq++; // Increment frequency if found
-         return false;    // Word already exists
+   HashTable* ht = (HashTable*)p;
+   const char* c = text;
+   const char* end = text + size;
+   int added = 0;
+   int bad = 0;
+   while (c < end) {
+      while (c < end && is_blank(*c)) {
+         c++;
+      }
+      const char* wd = c;
+      while (c < end && !is_blank(*c)) {
+         c++;
+      }
+      if (c == wd) {
+         break;
+      }
+      char lower_word[WORD_MAXLEN + 1];
+      if (norm_word(wd, (size_t)(c - wd), lower_word, NULL)) {
+         add_lower(ht, lower_word, (size_t)(c - wd));
+         added++;
+      } else {
+         bad++;
       }
-      current = current->next;
    }
 
-   // Create a new node for the word
-   HashNode* new_node = (HashNode*)malloc(sizeof(HashNode));
-   if (!new_node) {
-      fprintf(stderr, "Memory allocation failed in dict_addword\n");
-      exit(EXIT_FAILURE);
+   munmap((void*)text, size);
+   if (rejected) {
+      *rejected = bad;
    }
-   new_node->word = strdup(lower_word);
-   new_node->freq = 1;
-   new_node->next = ht->table[index];
-   ht->table[index] = new_node; // Insert at the beginning of the chain
-
-   return true; // Successfully added a new word
+   return added;
 }
 
 // Free the hash table
@@ -84,16 +496,21 @@ void dict_free(dict** d) {
       return;
    }
 
+   // The words are all in the slots or the arena: a few blocks in all
    HashTable* ht = (HashTable*)(*d);
-   for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-      HashNode* current = ht->table[i];
-      while (current) {
-         HashNode* temp = current;
-         current = current->next;
-         free(temp->word); // Free the word
-         free(temp);       // Free the node
-      }
+   free(ht->old.slot);
+   free(ht->cur.slot);
+   for (int i = 0; i < ht->arena_chunks; i++) {
+      free(ht->arena[i]);
+   }
+   for (int i = 0; i < ht->chunks; i++) {
+      free(ht->entry[i]);
+      free(ht->order[i]);
    }
+   free(ht->arena);
+   free(ht->entry);
+   free(ht->order);
+   free(ht->above);
    free(ht);  // Free the hash table structure
    *d = NULL; // Set pointer to NULL
 }
@@ -103,43 +520,126 @@ int dict_wordcount(const dict* p) {
    if (!p) {
       return 0;
    }
-
-   HashTable* ht = (HashTable*)p;
-   int count = 0;
-
-   for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-      HashNode* current = ht->table[i];
-      while (current) {
-         count += current->freq; // Add the frequency of each word
-         current = current->next;
-      }
-   }
-   return count;
+   // Kept up to date by dict_addword
+   return ((const HashTable*)p)->words;
 }
 
-// Check if a word exists in the hash table
+/* Check if a word exists in the hash table. The slot returned
+   stays valid only until the next word is added. */
 dict* dict_spell(const dict* p, const char* wd) {
    if (!p || !wd || !*wd) {
       return NULL; // Invalid input
    }
 
-   HashTable* ht = (HashTable*)p;
-   char lower_word[BUFFER_SIZE];
-   for (int i = 0; wd[i] != '\0'; i++) {
-      lower_word[i] = tolower(wd[i]);
+   const HashTable* ht = (const HashTable*)p;
+   char lower_word[WORD_MAXLEN + 1];
+   if (!norm_word(wd, strlen(wd), lower_word, NULL)) {
+      return NULL; // Not a word, or too long
    }
-   lower_word[strlen(wd)] = '\0';
+   size_t len = strlen(wd);
+   return (dict*)lookup(ht, lower_word, len, hash_function(ht->seed, lower_word, len));
+}
 
-   unsigned int index = hash_function(lower_word);
-   HashNode* current = ht->table[index];
+// One lookup of dict_spell_batch, probing a slot per visit
+typedef struct SpellLane {
+   char word[WORD_MAXLEN + 1]; // Lowercased word
+   size_t len;
+   unsigned int hash;
+   const SlotTable* table;     // Table being probed
+   unsigned int pos;           // Slot being fetched
+   unsigned int dist;          // How far pos is from home
+   bool compare;               // Fetching the arena word at pos to compare it
+   int index;                  // Which word this is, -1 if the lane is idle
+} SpellLane;
 
-   while (current) {
-      if (strcmp(current->word, lower_word) == 0) {
-         return (dict*)current; // Return node if word found
-      }
-      current = current->next;
+// Start probing table t for the word in lane ln
+static void lane_start(SpellLane* ln, const SlotTable* t) {
+   ln->table = t;
+   ln->pos = home_slot(t, ln->hash);
+   ln->dist = 0;
+   ln->compare = false;
+   PREFETCH(&t->slot[ln->pos]);
+}
+
+// Check many words, interleaving their probes and prefetching
+void dict_spell_batch(const dict* p, const char* const* words, int n, dict** results) {
+   if (!words || !results) {
+      return;
+   }
+   const HashTable* ht = (const HashTable*)p;
+   SpellLane lane[BATCH_LANES];
+   int next = 0;
+   int busy = 0;
+   for (int l = 0; l < BATCH_LANES; l++) {
+      lane[l].index = -1;
    }
-   return NULL; // Word not found
+
+   do {
+      busy = 0;
+      for (int l = 0; l < BATCH_LANES; l++) {
+         SpellLane* ln = &lane[l];
+
+         // An idle lane takes the next word and fetches its home slot
+         while (ln->index < 0 && next < n) {
+            const char* wd = words[next];
+            size_t len = wd ? strlen(wd) : 0;
+            if (!ht || !norm_word(wd, len, ln->word, NULL)) {
+               results[next++] = NULL;
+               continue;
+            }
+            ln->len = len;
+            ln->hash = hash_function(ht->seed, ln->word, len);
+            lane_start(ln, &ht->cur);
+            ln->index = next++;
+         }
+         if (ln->index < 0) {
+            continue;
+         }
+         busy++;
+
+         const SlotTable* t = ln->table;
+         const HashSlot* s = &t->slot[ln->pos];
+         if (ln->compare) {
+            if (memcmp(slot_key(ht, s), ln->word, ln->len) == 0) {
+               results[ln->index] = (dict*)s;
+               ln->index = -1;
+               continue;
+            }
+            ln->compare = false;
+            ln->pos = (ln->pos + 1) & t->mask;
+            ln->dist++;
+            continue;
+         }
+
+         // Step along the slots, which share cache lines, to a hash match
+         for (;;) {
+            s = &t->slot[ln->pos];
+            if (!s->len || slot_dist(t, ln->pos) < ln->dist) {
+               if (t == &ht->cur && ht->old.slot) {
+                  lane_start(ln, &ht->old); // Not moved across yet?
+               } else {
+                  results[ln->index] = NULL;
+                  ln->index = -1;
+               }
+               break;
+            }
+            if (s->hash == ln->hash && s->len == ln->len) {
+               if (s->len > INLINE_KEY) {
+                  PREFETCH(slot_key(ht, s)); // Compare next visit
+                  ln->compare = true;
+                  break;
+               }
+               if (memcmp(s->key, ln->word, ln->len) == 0) {
+                  results[ln->index] = (dict*)s;
+                  ln->index = -1;
+                  break;
+               }
+            }
+            ln->pos = (ln->pos + 1) & t->mask;
+            ln->dist++;
+         }
+      }
+   } while (busy || next < n);
 }
 
 // Find the frequency of the most common word
@@ -147,24 +647,189 @@ int dict_mostcommon(const dict* p) {
    if (!p) {
       return 0;
    }
+   // Kept up to date by dict_addword
+   return ((const HashTable*)p)->maxfreq;
+}
 
-   HashTable* ht = (HashTable*)p;
-   int max_freq = 0;
+// The n most frequent words and their counts, read off the kept order
+int dict_topn(const dict* p, int n, char* out_words[], int out_freqs[]) {
+   if (!p || n <= 0) {
+      return 0;
+   }
+   const HashTable* ht = (const HashTable*)p;
+   if (n > ht->count) {
+      n = ht->count;
+   }
+   for (int i = 0; i < n; i++) {
+      const HashEntry* en = entry_of(ht, *order_at(ht, i));
+      if (out_words) {
+         strcpy(out_words[i], arena_at(ht, en->text));
+      }
+      if (out_freqs) {
+         out_freqs[i] = en->freq;
+      }
+   }
+   return n;
+}
 
-   for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-      HashNode* current = ht->table[i];
-      while (current) {
-         if (current->freq > max_freq) {
-            max_freq = current->freq;
-         }
-         current = current->next;
+// Probe lengths counted one by one up to this, then together
+#define PROBE_HIST 8
+
+// Tally, for the words of table t from slot 'from' on, how far each sits from home
+static void probe_tally(const SlotTable* t, unsigned int from, int* hist, long* total, int* longest, int* run) {
+   int cur = 0;
+   for (unsigned int i = from; t->slot && i <= t->mask; i++) {
+      if (!t->slot[i].len) {
+         cur = 0;
+         continue;
+      }
+      unsigned int probes = slot_dist(t, i) + 1;
+      hist[probes < PROBE_HIST ? probes : PROBE_HIST]++;
+      *total += probes;
+      if ((int)probes > *longest) {
+         *longest = (int)probes;
+      }
+      if (++cur > *run) {
+         *run = cur;
+      }
+   }
+}
+
+// Print how far words sit from their home slots; returns the longest probe
+int dict_probe_report(const dict* p, FILE* fp) {
+   if (!p) {
+      return 0;
+   }
+   const HashTable* ht = (const HashTable*)p;
+   int hist[PROBE_HIST + 1] = {0};
+   long total = 0;
+   int longest = 0;
+   int run = 0;
+   probe_tally(&ht->cur, 0, hist, &total, &longest, &run);
+   probe_tally(&ht->old, ht->drained, hist, &total, &longest, &run);
+   if (fp) {
+      fprintf(fp, "%d words in %u slots (load %.2f)%s\n", ht->count, ht->cur.mask + 1,
+              (double)ht->count / (ht->cur.mask + 1), ht->old.slot ? ", resizing" : "");
+      fprintf(fp, "probes: mean %.2f, longest %d; longest run of full slots %d\n",
+              ht->count ? (double)total / ht->count : 0.0, longest, run);
+      for (int i = 1; i <= PROBE_HIST; i++) {
+         fprintf(fp, "  %s%d: %d\n", i == PROBE_HIST ? ">=" : "", i, hist[i]);
       }
    }
-   return max_freq;
+   return longest;
 }
 
-// Placeholder test function for compatibility with driver.
+// Frequency of word wd in p, for the tests
+static int ht_freq(const dict* p, const char* wd) {
+   const HashSlot* s = (const HashSlot*)dict_spell(p, wd);
+   return s ? entry_of((const HashTable*)p, (int)s->id)->freq : 0;
+}
+
+// Self-test of the hash table, run by driverext.c
 void test(void)
 {
-   // Testing is done in driverext.c
+   // Most testing is done in driverext.c
+   dict* d = dict_init();
+   int bad = -1;
+   assert(dict_load_file(d, "wordle.txt", &bad) == 2315);
+   assert(bad == 0);
+   assert(dict_wordcount(d) == 2315);
+   assert(dict_spell(d, "aback") && dict_spell(d, "zonal"));
+   assert(dict_load_file(d, "no-such-file.txt", &bad) == -1);
+
+   // Hashes fold case and depend on the table's own seed
+   dict* e = dict_init();
+   uint64_t seed = ((HashTable*)d)->seed;
+   assert(seed != ((HashTable*)e)->seed);
+   assert(hash_function(seed, "ABACK'S", 7) == hash_function(seed, "aback's", 7));
+   assert(hash_function(seed, "abc", 3) != hash_function(((HashTable*)e)->seed, "abc", 3));
+   const char* lng = "abcdefghijklmnopqrstuvwxyzabcdefghi";
+   assert(hash_function(seed, lng, 35) != hash_function(seed, lng, 34));
+   assert(dict_probe_report(e, NULL) == 0);
+   assert(dict_load_file(e, "english_65197.txt", NULL) == 65197);
+   assert(dict_probe_report(e, NULL) < 32 && dict_probe_report(d, NULL) < 16);
+   // Past the first chunk of entries, and of the arena
+   assert(!dict_addword(e, "Zwolle") && !dict_addword(e, "zwolle"));
+   char top1[WORD_MAXLEN + 1];
+   char* top1w = top1;
+   int top1f;
+   assert(dict_topn(e, 1, &top1w, &top1f) == 1 && strcmp(top1, "zwolle") == 0 && top1f == 3);
+   dict_free(&e);
+
+   // The most frequent words, kept in order as they are counted
+   e = dict_init();
+   char topbuf[50][WORD_MAXLEN + 1];
+   char* topw[50];
+   int topf[50];
+   for (int i = 0; i < 50; i++) {
+      topw[i] = topbuf[i];
+   }
+   assert(dict_topn(e, 5, topw, topf) == 0);
+   assert(dict_load_file(e, "p-and-p-words.txt", NULL) > 0);
+   assert(dict_topn(e, 50, topw, topf) == 50 && topf[0] == 4331);
+   for (int i = 0; i < 50; i++) {
+      assert(ht_freq(e, topw[i]) == topf[i] && (i == 0 || topf[i] <= topf[i - 1]));
+   }
+   dict_free(&e);
+   e = dict_init();
+   const char* few[] = {"b", "a", "Cat", "b", "cat", "cat"};
+   for (int i = 0; i < 6; i++) {
+      dict_addword(e, few[i]);
+   }
+   assert(dict_topn(e, 9, topw, NULL) == 3);
+   assert(strcmp(topw[0], "cat") == 0 && strcmp(topw[1], "b") == 0 && strcmp(topw[2], "a") == 0);
+   dict_free(&e);
+
+   // Batched lookups give what one-by-one lookups give
+   const char* look[] = {"aback", "Zonal", NULL, "", "abac", "zonals", "crane"};
+   dict* got[7];
+   dict_spell_batch(d, look, 7, got);
+   for (int i = 0; i < 7; i++) {
+      assert(got[i] == dict_spell(d, look[i]));
+   }
+   dict_free(&d);
+
+   // Words stay findable, counted once, while the table grows
+   d = dict_init();
+   char names[3000][4];
+   const char* all[3000];
+   for (int i = 0; i < 3000; i++) {
+      names[i][0] = (char)('a' + i / 676);
+      names[i][1] = (char)('a' + i / 26 % 26);
+      names[i][2] = (char)('a' + i % 26);
+      names[i][3] = '\0';
+      all[i] = names[i];
+      assert(dict_addword(d, names[i]));
+      assert(!dict_addword(d, names[i / 2]));
+      assert(dict_spell(d, names[i]) && dict_spell(d, names[i / 3]));
+      if (i == 1600) {
+         // Part way through a resize: both tables are looked in
+         dict* some[1601];
+         dict_spell_batch(d, all, 1601, some);
+         for (int j = 0; j <= 1600; j++) {
+            assert(some[j] == dict_spell(d, all[j]));
+         }
+      }
+   }
+   assert(dict_wordcount(d) == 6000 && dict_mostcommon(d) == 3);
+   assert(!dict_spell(d, "zzz") && !dict_spell(d, "ezz"));
+
+   // Words too long for a slot go to the arena, which grows
+   char longw[300][41];
+   for (int i = 0; i < 300; i++) {
+      memset(longw[i], 'q', 37);
+      memcpy(longw[i] + 37, names[i * 7], 4);
+      assert(dict_addword(d, longw[i]));
+      all[i] = longw[i];
+   }
+   longw[0][0] = 'Q';
+   assert(!dict_addword(d, longw[0]) && ht_freq(d, longw[0]) == 2);
+   longw[0][36] = 'x';
+   assert(!dict_spell(d, longw[0]) && !dict_spell(d, "qqqqqqqqqqqqqqqqqqqqqq"));
+   dict* found[300];
+   dict_spell_batch(d, all, 300, found);
+   for (int i = 1; i < 300; i++) {
+      assert(found[i] && found[i] == dict_spell(d, all[i]));
+   }
+   dict_free(&d);
 }
@@ -14,9 +14,14 @@ typedef struct HashTable dict;
 // Function prototypes
 dict* dict_init(void);                        // Initialize a hash table
 bool dict_addword(dict* p, const char* wd);   // Add a word to the hash table
+int dict_load_file(dict* p, const char* fname, int* rejected); // Add every word of a file
 void dict_free(dict** p);                     // Free the hash table
 int dict_wordcount(const dict* p);            // Count the total words
 dict* dict_spell(const dict* p, const char* wd); // Check if a word exists
+void dict_spell_batch(const dict* p, const char* const* words, int n, dict** results); // Check many words at once
 int dict_mostcommon(const dict* p);           // Find the frequency of the most common word
+int dict_topn(const dict* p, int n, char* out_words[], int out_freqs[]); // The n most common words, with counts
+int dict_probe_report(const dict* p, FILE* fp); // Print probe lengths (if fp), return the longest
+void test(void);                              // Self-test, called by driverext.c
 
 #endif // EXT_H
@@ -0,0 +1,60 @@
+#pragma once
+
+/* Word normalisation shared by the tree (t27.c) and the hash
+   table (ext.c), so both accept and reject exactly the same
+   words: 1 to WORD_MAXLEN characters, each a letter (either
+   case) or an apostrophe. Everything else is invalid. */
+#include <stdbool.h>
+#include <stddef.h>
+
+// Longest word either dictionary will take
+#define WORD_MAXLEN 255
+
+/* Slot + 1 of each character in the tree: a-z in either case
+   are 1-26, the apostrophe 27, and anything else 0. */
+static const unsigned char word_slot1[256] = {
+   ['a'] = 1,  ['b'] = 2,  ['c'] = 3,  ['d'] = 4,  ['e'] = 5,  ['f'] = 6,
+   ['g'] = 7,  ['h'] = 8,  ['i'] = 9,  ['j'] = 10, ['k'] = 11, ['l'] = 12,
+   ['m'] = 13, ['n'] = 14, ['o'] = 15, ['p'] = 16, ['q'] = 17, ['r'] = 18,
+   ['s'] = 19, ['t'] = 20, ['u'] = 21, ['v'] = 22, ['w'] = 23, ['x'] = 24,
+   ['y'] = 25, ['z'] = 26,
+   ['A'] = 1,  ['B'] = 2,  ['C'] = 3,  ['D'] = 4,  ['E'] = 5,  ['F'] = 6,
+   ['G'] = 7,  ['H'] = 8,  ['I'] = 9,  ['J'] = 10, ['K'] = 11, ['L'] = 12,
+   ['M'] = 13, ['N'] = 14, ['O'] = 15, ['P'] = 16, ['Q'] = 17, ['R'] = 18,
+   ['S'] = 19, ['T'] = 20, ['U'] = 21, ['V'] = 22, ['W'] = 23, ['X'] = 24,
+   ['Y'] = 25, ['Z'] = 26,
+   ['\''] = 27
+};
+
+// Slot of character c in the tree (0-25 a-z, 26 '), or -1 if invalid
+static inline int word_slot(char c)
+{
+   return (int)word_slot1[(unsigned char)c] - 1;
+}
+
+/* Checks the 'len' characters at wd, in one pass. If they make a
+   valid word, stores the lowercased word (terminated) in 'lower'
+   and the slots in 'slot', and returns true. Either may be NULL,
+   else each needs room for WORD_MAXLEN + 1. */
+static inline bool norm_word(const char* wd, size_t len, char* lower, unsigned char* slot)
+{
+   if (!wd || len == 0 || len > WORD_MAXLEN) {
+      return false;
+   }
+   for (size_t i = 0; i < len; i++) {
+      int s = word_slot(wd[i]);
+      if (s < 0) {
+         return false;
+      }
+      if (lower) {
+         lower[i] = (s == 26) ? '\'' : (char)('a' + s);
+      }
+      if (slot) {
+         slot[i] = (unsigned char)s;
+      }
+   }
+   if (lower) {
+      lower[len] = '\0';
+   }
+   return true;
+}
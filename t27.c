@@ -1,21 +1,298 @@
+// mmap and friends are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
 #include "t27.h"
+#include "norm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Define buffer size for string operations
-#define BUFFER_SIZE 256 
+// Bytes in each slab of the node arena
+#define SLAB_BYTES (1 << 18)
+
+// Size classes of child blocks: capacity 1, 2, 4, 8, 16, 32
+#define KID_CLASSES 6
+
+// Lookups in flight at once in dict_spell_batch
+#define BATCH_LANES 16
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
+
+#if defined(__GNUC__)
+#define POPCOUNT(x) __builtin_popcount(x)
+#else
+static int POPCOUNT(uint32_t x)
+{
+   int n = 0;
+   for (; x; x &= x - 1) {
+      n++;
+   }
+   return n;
+}
+#endif
+
+// Floor of log2 of x (x > 0)
+#if defined(__GNUC__)
+#define LOG2(x) (31 - __builtin_clz(x))
+#else
+static int LOG2(uint32_t x)
+{
+   int n = -1;
+   for (; x; x >>= 1) {
+      n++;
+   }
+   return n;
+}
+#endif
+
+// Index of the lowest set bit of x (x != 0)
+#if defined(__GNUC__)
+#define CTZ(x) __builtin_ctzll(x)
+#else
+static int CTZ(uint64_t x)
+{
+   int n = 0;
+   for (; !(x & 1u); x >>= 1) {
+      n++;
+   }
+   return n;
+}
+#endif
+
+/* Atomics for dict_writer and dict_versioned. Loads that may see
+   a child block (or version) published by another thread acquire,
+   and publishing releases, so what it points to is seen whole. The
+   fence orders a store before a later load, for the epochs. */
+#if defined(__GNUC__)
+#define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define ATOMIC_CAS(p, old, nu) \
+   __atomic_compare_exchange_n(p, &(old), nu, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define ATOMIC_ADD(p, n) __atomic_fetch_add(p, n, __ATOMIC_ACQ_REL)
+#define ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#error "dict_writer needs the GCC __atomic builtins"
+#endif
+
+/* The children of a node, in letter order (a-z then ').
+   Bit i of 'mask' is set if letter i has a child, which
+   lives at kid[number of set bits below bit i]. Blocks
+   have room for a power of two children and are swapped
+   for the next size up when they fill. */
+struct dict_kids {
+   uint32_t mask;
+   dict* kid[];
+};
+typedef struct dict_kids dict_kids;
+
+/* Nodes and child blocks are not allocated one at a time:
+   they are carved out of large zeroed slabs owned by the
+   dictionary, so building costs one calloc per slab and
+   dict_free releases whole slabs. */
+typedef struct slab {
+   struct slab* next; // Previously allocated slab
+   size_t used;       // Words (void*) handed out so far
+   size_t cap;        // Words that fit in this slab
+   void* mem[];
+} slab;
+
+/* The root node is allocated inside this header, so the dict*
+   the user holds (root) can be converted back to the header.
+   'root' must stay the first member. */
+typedef struct dict_hdr {
+   dict root;
+   slab* slabs;                  // Most recent slab first
+   dict_kids* spare[KID_CLASSES]; // Outgrown child blocks, by class
+   // Running totals kept by dict_addword, so the
+   // count queries on the top node don't recurse
+   int words;                    // Sum of freq over all terminals
+   int nodes;                    // Nodes in the tree, top included
+   int maxfreq;                  // Largest freq of any terminal
+   /* The terminals, most frequent first: order[i] has rank i,
+      and the first above[f] of them have freq greater than f. */
+   dict** order;
+   int ordered;                  // Terminals in 'order' (== above[0])
+   int order_cap;
+   int* above;                   // Indexed 0 .. maxfreq
+   int above_cap;
+   // Ranks of RANK_SPILL and over, by node (linear probing)
+   dict** spill_node;            // NULL where free
+   int* spill_rank;
+   int spilled;
+   int spill_cap;                // A power of two, or 0
+   int writers;                  // dict_writers open, -1 while settling (atomic)
+   slab* writer_slabs;           // Arenas of closed writers (atomic)
+} dict_hdr;
+
+// Finds the header of the dictionary that node p belongs to
+static dict_hdr* dict_header(const dict* p)
+{
+   while (p->up) {
+      p = p->up;
+   }
+   return (dict_hdr*)p;
+}
+
+// Adds a zeroed slab of (at least) 'bytes' to the arena
+static slab* slab_new(slab** slabs, size_t bytes)
+{
+   if (bytes < SLAB_BYTES) {
+      bytes = SLAB_BYTES;
+   }
+   size_t cap = (bytes + sizeof(void*) - 1) / sizeof(void*);
+   slab* s = (slab*)calloc(1, sizeof(slab) + cap * sizeof(void*));
+   if (!s) {
+      fprintf(stderr, "Memory allocation failed in slab_new\n");
+      exit(EXIT_FAILURE);
+   }
+   s->cap = cap;
+   s->next = *slabs;
+   *slabs = s;
+   return s;
+}
+
+// Hands out 'bytes' of zeroed, pointer-aligned arena memory
+static void* arena_alloc(slab** slabs, size_t bytes)
+{
+   size_t words = (bytes + sizeof(void*) - 1) / sizeof(void*);
+   slab* s = *slabs;
+   if (!s || s->cap - s->used < words) {
+      s = slab_new(slabs, bytes);
+   }
+   void* m = &s->mem[s->used];
+   s->used += words;
+   return m;
+}
+
+// Hands out the next zeroed node of the arena, linked to its parent
+static dict* node_new(dict_hdr* h, dict* parent)
+{
+   dict* n = (dict*)arena_alloc(&h->slabs, sizeof(dict));
+   n->up = parent;
+   n->depth = parent->depth + 1;
+   h->nodes++;
+   return n;
+}
+
+// Size class of a block holding n children (n > 0)
+static int kids_class(int n)
+{
+   int c = 0;
+   while ((1 << c) < n) {
+      c++;
+   }
+   return c;
+}
+
+// A child block with room for n children, reusing outgrown ones
+static dict_kids* kids_new(dict_hdr* h, int n)
+{
+   int c = kids_class(n);
+   dict_kids* k = h->spare[c];
+   if (k) {
+      // Spare blocks are chained through their first slot
+      h->spare[c] = (dict_kids*)k->kid[0];
+      memset(k, 0, sizeof(dict_kids) + ((size_t)1 << c) * sizeof(dict*));
+      return k;
+   }
+   return (dict_kids*)arena_alloc(&h->slabs, sizeof(dict_kids) + ((size_t)1 << c) * sizeof(dict*));
+}
+
+// Child of p for letter slot i, or NULL if there isn't one
+static inline dict* dict_child(const dict* p, int i)
+{
+   const dict_kids* k = p->dwn;
+   if (!k || !((k->mask >> i) & 1u)) {
+      return NULL;
+   }
+   return k->kid[POPCOUNT(k->mask & ((1u << i) - 1))];
+}
+
+// Creates the child of p for letter slot i (which must not exist yet)
+static dict* child_add(dict_hdr* h, dict* p, int i)
+{
+   dict_kids* k = p->dwn;
+   uint32_t mask = k ? k->mask : 0;
+   int n = POPCOUNT(mask);
+   int at = POPCOUNT(mask & ((1u << i) - 1));
+
+   // A block is full when its count is zero or a power of two
+   if ((n & (n - 1)) == 0) {
+      dict_kids* g = kids_new(h, n + 1);
+      if (k) {
+         memcpy(g->kid, k->kid, (size_t)at * sizeof(dict*));
+         memcpy(&g->kid[at + 1], &k->kid[at], (size_t)(n - at) * sizeof(dict*));
+         int c = kids_class(n);
+         k->kid[0] = (dict*)h->spare[c];
+         h->spare[c] = k;
+      }
+      p->dwn = k = g;
+   } else {
+      memmove(&k->kid[at + 1], &k->kid[at], (size_t)(n - at) * sizeof(dict*));
+   }
+
+   dict* c = node_new(h, p);
+   k->kid[at] = c;
+   k->mask = mask | (1u << i);
+   return c;
+}
+
+/* Better of two candidate completions: higher freq wins, and
+   on a tie the one seen first (earlier in the alphabet) stays. */
+static const dict* best_of(const dict* b, const dict* c)
+{
+   if (c && (!b || c->freq > b->freq)) {
+      return c;
+   }
+   return b;
+}
+
+// Best terminal strictly below p, from the children's cached bests
+static const dict* best_below(const dict* p)
+{
+   const dict* b = NULL;
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         b = best_of(b, p->dwn->kid[i]->best);
+      }
+   }
+   return b;
+}
+
+/* Terminal t has just been added or had its freq bumped: walk up
+   refreshing each ancestor's cached best, until one is unaffected.
+   A word is alphabetically before everything below it, so a node
+   is checked ahead of its children. */
+static void best_update(dict* t)
+{
+   for (dict* a = t; a; a = a->up) {
+      const dict* old = a->best;
+      a->best = (dict*)best_of(a->terminal ? a : NULL, best_below(a));
+      if (a->best == old && old != t) {
+         return;
+      }
+   }
+}
 
 dict* dict_init(void)
 {
-   // Allocate memory for the root node of the dictionary tree.
+   // Allocate memory for the header holding the root node.
    // If allocation fails, the program will terminate.
-   dict* root = (dict*)calloc(1, sizeof(dict));
-   if (!root) {
+   dict_hdr* h = (dict_hdr*)calloc(1, sizeof(dict_hdr));
+   if (!h) {
       fprintf(stderr, "Memory allocation failed in dict_init\n");
       exit(EXIT_FAILURE);
    }
+   dict* root = &h->root;
 
    // Initialize fields of the root node.
    // The root node does not have a parent.
@@ -27,10 +304,286 @@ dict* dict_init(void)
    // The initial frequency is zero.
    root->freq = 0;
 
+   // No slabs until the first word arrives.
+   h->slabs = NULL;
+
+   // Only the top node so far.
+   h->nodes = 1;
+
    // Return the pointer to the initialized root node.
    return root;
 }
 
+void dict_reserve(dict* p, int n)
+{
+   if (!p || n <= 0) {
+      return;
+   }
+
+   // Each node also needs a slot (and sometimes a block) in its parent
+   size_t bytes = (size_t)n * (sizeof(dict) + 2 * sizeof(dict*));
+   dict_hdr* h = dict_header(p);
+   if (!h->slabs || (h->slabs->cap - h->slabs->used) * sizeof(void*) < bytes) {
+      slab_new(&h->slabs, bytes);
+   }
+}
+
+
+/* A rank is kept in its node while it fits the node's 23 bits.
+   From RANK_SPILL on (a dictionary of over 8 million different
+   words), the node holds RANK_SPILL and the rank itself is in
+   the header's side table. */
+#define RANK_SPILL ((1u << 23) - 1)
+
+// Where t's search starts in the side table
+static int spill_home(const dict_hdr* h, const dict* t)
+{
+   uint64_t x = (uint64_t)(uintptr_t)t * 0x9E3779B97F4A7C15u;
+   return (int)(x >> 40) & (h->spill_cap - 1);
+}
+
+// Slot of t in the side table, or of the free slot where it would go
+static int spill_find(const dict_hdr* h, const dict* t)
+{
+   int i = spill_home(h, t);
+   while (h->spill_node[i] && h->spill_node[i] != t) {
+      i = (i + 1) & (h->spill_cap - 1);
+   }
+   return i;
+}
+
+// Doubles the side table, rehashing what is in it
+static void spill_grow(dict_hdr* h)
+{
+   dict** old_node = h->spill_node;
+   int* old_rank = h->spill_rank;
+   int old_cap = h->spill_cap;
+   h->spill_cap = old_cap ? old_cap * 2 : 64;
+   h->spill_node = (dict**)calloc((size_t)h->spill_cap, sizeof(dict*));
+   h->spill_rank = (int*)malloc((size_t)h->spill_cap * sizeof(int));
+   if (!h->spill_node || !h->spill_rank) {
+      fprintf(stderr, "Memory allocation failed in dict_addword\n");
+      exit(EXIT_FAILURE);
+   }
+   for (int i = 0; i < old_cap; i++) {
+      if (old_node[i]) {
+         int j = spill_find(h, old_node[i]);
+         h->spill_node[j] = old_node[i];
+         h->spill_rank[j] = old_rank[i];
+      }
+   }
+   free(old_node);
+   free(old_rank);
+}
+
+// Takes t out of the side table, closing the gap behind it
+static void spill_remove(dict_hdr* h, const dict* t)
+{
+   if (!h->spill_cap) {
+      return;
+   }
+   int i = spill_find(h, t);
+   if (!h->spill_node[i]) {
+      return;
+   }
+   int mask = h->spill_cap - 1;
+   for (int j = (i + 1) & mask; h->spill_node[j]; j = (j + 1) & mask) {
+      // An entry moves back into the gap unless its home is in (i, j]
+      if (((j - spill_home(h, h->spill_node[j])) & mask) >= ((j - i) & mask)) {
+         h->spill_node[i] = h->spill_node[j];
+         h->spill_rank[i] = h->spill_rank[j];
+         i = j;
+      }
+   }
+   h->spill_node[i] = NULL;
+   h->spilled--;
+}
+
+// Rank of terminal t
+static int rank_get(const dict_hdr* h, const dict* t)
+{
+   if (t->rank < RANK_SPILL) {
+      return (int)t->rank;
+   }
+   return h->spill_rank[spill_find(h, t)];
+}
+
+// Sets the rank of terminal t to r
+static void rank_set(dict_hdr* h, dict* t, int r)
+{
+   if (t->rank == RANK_SPILL && (unsigned)r < RANK_SPILL) {
+      spill_remove(h, t);
+   }
+   if ((unsigned)r < RANK_SPILL) {
+      t->rank = (unsigned)r;
+      return;
+   }
+   if (t->rank != RANK_SPILL && 2 * (h->spilled + 1) > h->spill_cap) {
+      spill_grow(h);
+   }
+   int i = spill_find(h, t);
+   if (!h->spill_node[i]) {
+      h->spill_node[i] = t;
+      h->spilled++;
+   }
+   h->spill_rank[i] = r;
+   t->rank = RANK_SPILL;
+}
+
+// Makes sure above[0 .. f] exist, new entries zero
+static void above_grow(dict_hdr* h, int f)
+{
+   if (f < h->above_cap) {
+      return;
+   }
+   int cap = h->above_cap ? h->above_cap : 16;
+   while (cap <= f) {
+      cap *= 2;
+   }
+   h->above = (int*)realloc(h->above, (size_t)cap * sizeof(int));
+   if (!h->above) {
+      fprintf(stderr, "Memory allocation failed in dict_addword\n");
+      exit(EXIT_FAILURE);
+   }
+   memset(h->above + h->above_cap, 0, (size_t)(cap - h->above_cap) * sizeof(int));
+   h->above_cap = cap;
+}
+
+// Puts new terminal t last in the order, where freq 1 words go
+static void order_add(dict_hdr* h, dict* t)
+{
+   if (h->ordered == h->order_cap) {
+      h->order_cap = h->order_cap ? h->order_cap * 2 : 64;
+      h->order = (dict**)realloc(h->order, (size_t)h->order_cap * sizeof(dict*));
+      if (!h->order) {
+         fprintf(stderr, "Memory allocation failed in dict_addword\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   above_grow(h, 1);
+   t->rank = 0; // Any rank it had was in another order
+   rank_set(h, t, h->ordered);
+   h->order[h->ordered++] = t;
+   h->above[0]++;
+}
+
+/* Terminal t's freq has just gone from f to f + 1: swap it with
+   the first word of freq f, which moves the boundary above f on
+   by one. The order stays sorted, at O(1) per word added. */
+static void order_bump(dict_hdr* h, dict* t, int f)
+{
+   above_grow(h, f + 1);
+   int j = h->above[f];
+   dict* o = h->order[j];
+   int r = rank_get(h, t);
+   h->order[r] = o;
+   rank_set(h, o, r);
+   h->order[j] = t;
+   rank_set(h, t, j);
+   h->above[f]++;
+}
+
+/* Rebuilds the order from the 'ordered' terminals in h->order,
+   in any order, by counting sort on freq. */
+static void order_rebuild(dict_hdr* h)
+{
+   above_grow(h, h->maxfreq + 1);
+   memset(h->above, 0, (size_t)h->above_cap * sizeof(int));
+   for (int i = 0; i < h->ordered; i++) {
+      h->above[h->order[i]->freq - 1]++;
+   }
+   // above[f] so far counts freq f + 1: sum from the top down
+   for (int f = h->maxfreq - 1; f >= 0; f--) {
+      h->above[f] += h->above[f + 1];
+   }
+   dict** sorted = (dict**)malloc((size_t)(h->order_cap ? h->order_cap : 1) * sizeof(dict*));
+   int* fill = (int*)malloc((size_t)(h->maxfreq + 2) * sizeof(int));
+   if (!sorted || !fill) {
+      fprintf(stderr, "Memory allocation failed in order_rebuild\n");
+      exit(EXIT_FAILURE);
+   }
+   for (int f = 1; f <= h->maxfreq; f++) {
+      fill[f] = h->above[f]; // Words of freq f start after those above it
+   }
+   // Every rank is set afresh, so the side table starts empty
+   if (h->spill_cap) {
+      memset(h->spill_node, 0, (size_t)h->spill_cap * sizeof(dict*));
+      h->spilled = 0;
+   }
+   for (int i = 0; i < h->ordered; i++) {
+      dict* t = h->order[i];
+      t->rank = 0;
+      rank_set(h, t, fill[t->freq]);
+      sorted[fill[t->freq]++] = t;
+   }
+   free(h->order);
+   free(fill);
+   h->order = sorted;
+}
+
+// Counts one more occurrence of the word ending at 'current'
+static bool word_end(dict_hdr* h, dict* current)
+{
+   // Every call that gets here adds one to the word total
+   h->words++;
+
+   // Check if the word already exists
+   if (current->terminal) {
+      order_bump(h, current, current->freq);
+      current->freq++; // Increase frequency
+      if (current->freq > h->maxfreq) {
+         h->maxfreq = current->freq;
+      }
+      best_update(current);
+      return false;    // Word already existed
+   }
+
+   // Mark the node as the end of a word
+   current->terminal = true;
+   current->freq = 1; // Initialize frequency
+   if (h->maxfreq < 1) {
+      h->maxfreq = 1;
+   }
+   order_add(h, current);
+   best_update(current);
+
+   return true; // Successfully added a new word
+}
+
+// Adds the word with letter slots slot[0 .. len) below p, in dictionary h
+static bool add_slots(dict_hdr* h, dict* p, const unsigned char* slot, size_t len)
+{
+   dict* current = p;
+
+   // Process each letter of the word
+   for (size_t i = 0; i < len; i++) {
+      int index = slot[i];
+
+      // If the path doesn't exist, create a new node
+      dict* next = dict_child(current, index);
+      if (!next) {
+         next = child_add(h, current, index);
+      }
+
+      // Move to the next node
+      current = next;
+   }
+
+   return word_end(h, current);
+}
+
+/* Adds the 'len' characters at wd below p, in dictionary h.
+   Same result as dict_addword, but wd needn't be terminated.
+   The whole word is checked first, so a bad one adds nothing. */
+static bool addword_n(dict_hdr* h, dict* p, const char* wd, size_t len)
+{
+   unsigned char slot[WORD_MAXLEN + 1];
+   // No word may end deeper than WORD_MAXLEN letters from the top
+   if (!norm_word(wd, len, NULL, slot) || p->depth + len > WORD_MAXLEN) {
+      return false;
+   }
+   return add_slots(h, p, slot, len);
+}
 
 bool dict_addword(dict* p, const char* wd)
 {
@@ -39,285 +592,2919 @@ bool dict_addword(dict* p, const char* wd)
       return false;
    }
 
-   dict* current = p;
+   return addword_n(dict_header(p), p, wd, strlen(wd));
+}
 
-   // Process each character in the word
-   while (*wd) {
-      int index;
+// Whitespace separating the words of a word file
+static inline bool is_blank(char c)
+{
+   return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
 
-      // Calculate the index for the current character
-      if (*wd == '\'') {
-         index = 26; // Apostrophe
-      } else if (isalpha(*wd)) {
-         index = tolower(*wd) - 'a'; // Lowercase letters
+int dict_load_file(dict* p, const char* fname, int* rejected)
+{
+   if (rejected) {
+      *rejected = 0;
+   }
+   if (!p || !fname) {
+      return -1;
+   }
+
+   // Map the whole file read-only; words are read where they lie
+   int fd = open(fname, O_RDONLY);
+   if (fd < 0) {
+      return -1;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      close(fd);
+      return -1;
+   }
+   size_t size = (size_t)st.st_size;
+   if (size == 0) {
+      close(fd);
+      return 0;
+   }
+   const char* text = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (text == MAP_FAILED) {
+      return -1;
+   }
+   posix_madvise((void*)text, size, POSIX_MADV_SEQUENTIAL);
+
+   // One pass: find each word, check it, insert it
+   dict_hdr* h = dict_header(p);
+   const char* c = text;
+   const char* end = text + size;
+   int added = 0;
+   int bad = 0;
+   while (c < end) {
+      while (c < end && is_blank(*c)) {
+         c++;
+      }
+      const char* wd = c;
+      while (c < end && !is_blank(*c)) {
+         c++;
+      }
+      if (c == wd) {
+         break;
+      }
+      unsigned char slot[WORD_MAXLEN + 1];
+      if (norm_word(wd, (size_t)(c - wd), NULL, slot) && p->depth + (size_t)(c - wd) <= WORD_MAXLEN) {
+         add_slots(h, p, slot, (size_t)(c - wd));
+         added++;
       } else {
-         return false; // Invalid character
+         bad++;
       }
+   }
 
-      // If the path doesn't exist, create a new node
-      if (!current->dwn[index]) {
-         current->dwn[index] = (dict*)calloc(1, sizeof(dict));
-         if (!current->dwn[index]) {
-            fprintf(stderr, "Memory allocation failed in dict_addword\n");
-            exit(EXIT_FAILURE);
+   munmap((void*)text, size);
+   if (rejected) {
+      *rejected = bad;
+   }
+   return added;
+}
+
+/* Work shared by the dict_build_parallel threads: the words
+   bucketed by their first letter, and the subtrees built so far. */
+typedef struct build_job {
+   const char* const* words;
+   int* order;                 // Word numbers, grouped by first letter
+   int start[ALPHA + 1];       // Bucket i is order[start[i] .. start[i+1])
+   int queue[ALPHA];           // Buckets, largest first
+   int queued;
+   int next;                   // Next entry of 'queue' to hand out
+   pthread_mutex_t lock;
+   dict* sub[ALPHA];           // Separate tree built for each bucket
+} build_job;
+
+/* Each thread takes whole buckets and builds each into its own
+   dictionary (and arena), so threads never share a node. */
+static void* build_worker(void* arg)
+{
+   build_job* job = (build_job*)arg;
+   for (;;) {
+      pthread_mutex_lock(&job->lock);
+      int q = job->next < job->queued ? job->queue[job->next++] : -1;
+      pthread_mutex_unlock(&job->lock);
+      if (q < 0) {
+         return NULL;
+      }
+      dict* d = dict_init();
+      dict_hdr* h = (dict_hdr*)d;
+      for (int i = job->start[q]; i < job->start[q + 1]; i++) {
+         const char* wd = job->words[job->order[i]];
+         addword_n(h, d, wd, strlen(wd));
+      }
+      job->sub[q] = d;
+   }
+}
+
+dict* dict_build_parallel(const char* const* words, int n, int nthreads)
+{
+   if (!words || n < 0) {
+      return NULL;
+   }
+   build_job* job = (build_job*)calloc(1, sizeof(build_job));
+   int* slot = (int*)malloc((size_t)n * sizeof(int) + 1);
+   int* order = (int*)malloc((size_t)n * sizeof(int) + 1);
+   if (!job || !slot || !order) {
+      fprintf(stderr, "Memory allocation failed in dict_build_parallel\n");
+      exit(EXIT_FAILURE);
+   }
+   job->words = words;
+   job->order = order;
+
+   /* Bucket the words by first letter, keeping their order. Words
+      that can't even start a path would add nothing, so drop them. */
+   int count[ALPHA] = {0};
+   for (int i = 0; i < n; i++) {
+      slot[i] = (words[i] && *words[i]) ? word_slot(*words[i]) : -1;
+      if (slot[i] >= 0) {
+         count[slot[i]]++;
+      }
+   }
+   for (int i = 0; i < ALPHA; i++) {
+      job->start[i + 1] = job->start[i] + count[i];
+   }
+   int fill[ALPHA];
+   memcpy(fill, job->start, sizeof(fill));
+   for (int i = 0; i < n; i++) {
+      if (slot[i] >= 0) {
+         job->order[fill[slot[i]]++] = i;
+      }
+   }
+   free(slot);
+
+   // Hand out the biggest buckets first to even out the threads
+   for (int i = 0; i < ALPHA; i++) {
+      if (count[i]) {
+         int at = job->queued++;
+         while (at > 0 && count[job->queue[at - 1]] < count[i]) {
+            job->queue[at] = job->queue[at - 1];
+            at--;
+         }
+         job->queue[at] = i;
+      }
+   }
+
+   pthread_mutex_init(&job->lock, NULL);
+   if (nthreads > job->queued) {
+      nthreads = job->queued;
+   }
+   pthread_t* tid = (pthread_t*)malloc((size_t)(nthreads > 1 ? nthreads : 1) * sizeof(pthread_t));
+   if (!tid) {
+      fprintf(stderr, "Memory allocation failed in dict_build_parallel\n");
+      exit(EXIT_FAILURE);
+   }
+   int started = 0;
+   for (int t = 1; t < nthreads; t++) {
+      if (pthread_create(&tid[started], NULL, build_worker, job) == 0) {
+         started++;
+      }
+   }
+   // The calling thread works too (and alone, if no threads started)
+   build_worker(job);
+   for (int t = 0; t < started; t++) {
+      pthread_join(tid[t], NULL);
+   }
+   free(tid);
+   pthread_mutex_destroy(&job->lock);
+
+   /* Graft: each bucket's tree has a single child under its top
+      node. Hang those children off a fresh top node, hand their
+      slabs over to it, and merge the running totals. */
+   dict* root = dict_init();
+   dict_hdr* h = (dict_hdr*)root;
+   if (job->queued) {
+      root->dwn = kids_new(h, job->queued);
+   }
+   for (int i = 0; i < ALPHA; i++) {
+      dict_hdr* sh = (dict_hdr*)job->sub[i];
+      if (!sh) {
+         continue;
+      }
+      if (!sh->root.dwn) {
+         dict_free(&job->sub[i]); // Every word in the bucket was bad
+         continue;
+      }
+      dict* c = sh->root.dwn->kid[0];
+      c->up = root;
+      root->dwn->kid[POPCOUNT(root->dwn->mask)] = c;
+      root->dwn->mask |= 1u << i;
+
+      h->words += sh->words;
+      h->nodes += sh->nodes - 1;
+      if (sh->maxfreq > h->maxfreq) {
+         h->maxfreq = sh->maxfreq;
+      }
+      // Their words join ours, to be put in order once all are in
+      for (int j = 0; j < sh->ordered; j++) {
+         order_add(h, sh->order[j]);
+      }
+      free(sh->order);
+      free(sh->above);
+      free(sh->spill_node);
+      free(sh->spill_rank);
+      // Their slabs go after ours, so ours stays the one in use
+      slab* s = sh->slabs;
+      while (s) {
+         slab* next = s->next;
+         if (h->slabs) {
+            s->next = h->slabs->next;
+            h->slabs->next = s;
+         } else {
+            s->next = NULL;
+            h->slabs = s;
          }
-         current->dwn[index]->up = current; // Set parent node
+         s = next;
       }
+      free(sh);
+   }
+   root->best = (dict*)best_below(root);
+   order_rebuild(h);
 
-      // Move to the next node
-      current = current->dwn[index];
-      wd++;
+   free(job->order);
+   free(job);
+   return root;
+}
+
+int dict_addsorted(dict* p, const char* const* words, int n)
+{
+   if (!p || !words || n <= 0) {
+      return 0;
    }
+   dict_hdr* h = dict_header(p);
 
-   // Check if the word already exists
-   if (current->terminal) {
-      current->freq++; // Increase frequency
-      return false;    // Word already existed
+   /* The previous word: its lowercased letters, and path[i], the
+      node reached after its first i letters. */
+   char prev[WORD_MAXLEN + 1];
+   dict* path[WORD_MAXLEN + 1];
+   int plen = 0;
+   path[0] = p;
+
+   int added = 0;
+   for (int w = 0; w < n; w++) {
+      const char* wd = words[w];
+      char lower[WORD_MAXLEN + 1];
+      unsigned char slot[WORD_MAXLEN + 1];
+      if (!wd || !norm_word(wd, strlen(wd), lower, slot)) {
+         continue; // Invalid, adds nothing
+      }
+      int len = (int)strlen(wd);
+      if (p->depth + len > WORD_MAXLEN) {
+         continue; // Would end too deep
+      }
+
+      // Shared prefix with the previous word, which must not sort after this one
+      int lcp = 0;
+      while (lcp < len && lcp < plen && lower[lcp] == prev[lcp]) {
+         lcp++;
+      }
+      bool sorted = lcp == len ? lcp == plen
+                               : lcp == plen || (unsigned char)lower[lcp] > (unsigned char)prev[lcp];
+      if (!sorted) {
+         // Out of order: insert from the top as usual
+         lcp = 0;
+      }
+
+      // Resume from the shared prefix, appending the rest
+      dict* current = path[lcp];
+      for (int i = lcp; i < len; i++) {
+         dict* next = dict_child(current, slot[i]);
+         if (!next) {
+            next = child_add(h, current, slot[i]);
+         }
+         prev[i] = lower[i];
+         path[i + 1] = current = next;
+      }
+      plen = len;
+      word_end(h, current);
+      added++;
+   }
+
+   return added;
+}
+
+/* Whole-tree walks (the counts below a node, and the clean-up once
+   the last dict_writer closes) split big trees across threads. The
+   tasks are the subtrees two levels below the top of the walk; each
+   thread starts with a share of them in its own deque, works from
+   one end of it, and when it runs dry takes from the other end of
+   someone else's. Every thread adds into its own accumulator, and
+   the caller combines them. Small trees are walked on one thread:
+   starting threads would cost more than it saves. */
+// t27.h quotes both of these for the count functions
+#define PAR_MIN_NODES (1 << 16)
+#define PAR_MAX_THREADS 8
+
+typedef struct par_deque {
+   pthread_mutex_t lock;
+   int lo, hi;                 // Tasks [lo, hi) still to do
+} par_deque;
+
+typedef struct par_pool {
+   dict** task;
+   par_deque deque[PAR_MAX_THREADS];
+   int nthreads;
+   void (*run)(void* acc, dict* node);
+   char* acc;                  // Thread t's accumulator at acc + t * acc_size
+   size_t acc_size;
+} par_pool;
+
+typedef struct par_worker {
+   par_pool* pool;
+   int self;
+} par_worker;
+
+// Own tasks from the back, then others' from the front; -1 once none are left
+static int par_take(par_pool* pool, int self)
+{
+   for (int i = 0; i < pool->nthreads; i++) {
+      int t = (self + i) % pool->nthreads;
+      par_deque* q = &pool->deque[t];
+      int got = -1;
+      pthread_mutex_lock(&q->lock);
+      if (q->lo < q->hi) {
+         got = (t == self) ? --q->hi : q->lo++;
+      }
+      pthread_mutex_unlock(&q->lock);
+      if (got >= 0) {
+         return got;
+      }
+   }
+   return -1;
+}
+
+static void* par_worker_run(void* arg)
+{
+   par_worker* w = (par_worker*)arg;
+   par_pool* pool = w->pool;
+   void* acc = pool->acc + (size_t)w->self * pool->acc_size;
+   for (int i; (i = par_take(pool, w->self)) >= 0;) {
+      pool->run(acc, pool->task[i]);
+   }
+   return NULL;
+}
+
+// Threads worth using on a tree of 'nodes' nodes (1 if it is small)
+static int par_threads(int nodes)
+{
+   if (nodes < PAR_MIN_NODES) {
+      return 1;
+   }
+   // Asked once: the answer comes from the file system (0 until then)
+   static int cpus = 0;
+   int n = ATOMIC_LOAD(&cpus);
+   if (n == 0) {
+      long c = sysconf(_SC_NPROCESSORS_ONLN);
+      n = c < 1 ? 1 : (c < PAR_MAX_THREADS ? (int)c : PAR_MAX_THREADS);
+      ATOMIC_STORE(&cpus, n);
+   }
+   return n;
+}
+
+/* Gathers the nodes two levels below p as tasks (their parents and
+   p itself are for the caller). Returns how many; *task is malloc'd. */
+static int par_tasks(const dict* p, dict*** task)
+{
+   int n = 0;
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         const dict* c = p->dwn->kid[i];
+         n += c->dwn ? POPCOUNT(c->dwn->mask) : 0;
+      }
+   }
+   *task = (dict**)malloc((size_t)(n > 0 ? n : 1) * sizeof(dict*));
+   if (!*task) {
+      fprintf(stderr, "Memory allocation failed in par_tasks\n");
+      exit(EXIT_FAILURE);
+   }
+   n = 0;
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         const dict* c = p->dwn->kid[i];
+         for (int j = 0; c->dwn && j < POPCOUNT(c->dwn->mask); j++) {
+            (*task)[n++] = c->dwn->kid[j];
+         }
+      }
+   }
+   return n;
+}
+
+/* Runs run(acc_t, task[i]) for every task on up to 'nthreads'
+   threads (the caller's among them), acc_t being thread t's zeroed
+   accumulator of acc_size bytes. Returns the accumulators, to be
+   combined and freed by the caller, and the number used in *used. */
+static void* par_run(dict** task, int n, int nthreads, void (*run)(void* acc, dict* node),
+                     size_t acc_size, int* used)
+{
+   if (nthreads > n) {
+      nthreads = n > 0 ? n : 1;
+   }
+   par_pool pool;
+   pool.task = task;
+   pool.nthreads = nthreads;
+   pool.run = run;
+   pool.acc_size = acc_size;
+   pool.acc = (char*)calloc((size_t)nthreads, acc_size);
+   if (!pool.acc) {
+      fprintf(stderr, "Memory allocation failed in par_run\n");
+      exit(EXIT_FAILURE);
+   }
+   par_worker worker[PAR_MAX_THREADS];
+   for (int t = 0; t < nthreads; t++) {
+      pthread_mutex_init(&pool.deque[t].lock, NULL);
+      pool.deque[t].lo = (int)((int64_t)n * t / nthreads);
+      pool.deque[t].hi = (int)((int64_t)n * (t + 1) / nthreads);
+      worker[t].pool = &pool;
+      worker[t].self = t;
+   }
+   pthread_t tid[PAR_MAX_THREADS];
+   bool started[PAR_MAX_THREADS] = {false};
+   for (int t = 1; t < nthreads; t++) {
+      started[t] = pthread_create(&tid[t], NULL, par_worker_run, &worker[t]) == 0;
+   }
+   // The calling thread works too, and steals whatever a thread that didn't start left
+   par_worker_run(&worker[0]);
+   for (int t = 1; t < nthreads; t++) {
+      if (started[t]) {
+         pthread_join(tid[t], NULL);
+      }
+   }
+   for (int t = 0; t < nthreads; t++) {
+      pthread_mutex_destroy(&pool.deque[t].lock);
+   }
+   *used = nthreads;
+   return pool.acc;
+}
+
+// What dict_wordcount, dict_nodecount and dict_mostcommon give, at once
+typedef struct tree_stats {
+   int words;
+   int nodes;
+   int maxfreq;
+} tree_stats;
+
+static void stats_add(tree_stats* s, const dict* p)
+{
+   s->nodes++;
+   if (p->terminal) {
+      s->words += p->freq;
+      if (p->freq > s->maxfreq) {
+         s->maxfreq = p->freq;
+      }
+   }
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         stats_add(s, p->dwn->kid[i]);
+      }
+   }
+}
+
+// stats_add, giving up (false) once s has counted more than 'limit' nodes
+static bool stats_add_upto(tree_stats* s, const dict* p, int limit)
+{
+   s->nodes++;
+   if (p->terminal) {
+      s->words += p->freq;
+      if (p->freq > s->maxfreq) {
+         s->maxfreq = p->freq;
+      }
+   }
+   if (s->nodes > limit) {
+      return false;
+   }
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         if (!stats_add_upto(s, p->dwn->kid[i], limit)) {
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+static void stats_task(void* acc, dict* node)
+{
+   stats_add((tree_stats*)acc, node);
+}
+
+// The stats of p's subtree, in parallel: p and its children here, the rest as tasks
+static tree_stats stats_par(const dict* p, int nthreads)
+{
+   tree_stats s = {0, 0, 0};
+   const dict* top[ALPHA + 1];
+   int ntop = 0;
+   top[ntop++] = p;
+   for (int i = 0; p->dwn && i < POPCOUNT(p->dwn->mask); i++) {
+      top[ntop++] = p->dwn->kid[i];
+   }
+   for (int i = 0; i < ntop; i++) {
+      s.nodes++;
+      if (top[i]->terminal) {
+         s.words += top[i]->freq;
+         if (top[i]->freq > s.maxfreq) {
+            s.maxfreq = top[i]->freq;
+         }
+      }
+   }
+   dict** task;
+   int n = par_tasks(p, &task);
+   int used;
+   tree_stats* acc = (tree_stats*)par_run(task, n, nthreads, stats_task, sizeof(tree_stats), &used);
+   for (int t = 0; t < used; t++) {
+      s.words += acc[t].words;
+      s.nodes += acc[t].nodes;
+      if (acc[t].maxfreq > s.maxfreq) {
+         s.maxfreq = acc[t].maxfreq;
+      }
+   }
+   free(acc);
+   free(task);
+   return s;
+}
+
+/* The stats of p's subtree, if p is near enough its top (the pool's
+   tasks are two levels down): counted here, or by stats_par once
+   more than PAR_MIN_NODES nodes turn up. Nothing climbs 'up', as a
+   node a dict_versioned shares between versions may have its 'up'
+   in a version already freed. */
+static bool stats_big(const dict* p, tree_stats* s)
+{
+   if (p->depth > 2) {
+      return false;
+   }
+   memset(s, 0, sizeof(*s));
+   if (stats_add_upto(s, p, PAR_MIN_NODES)) {
+      return true;
+   }
+   int nthreads = par_threads(s->nodes);
+   memset(s, 0, sizeof(*s));
+   if (nthreads < 2) {
+      stats_add(s, p);
+   } else {
+      *s = stats_par(p, nthreads);
+   }
+   return true;
+}
+
+/* One thread's handle for adding words while other threads do
+   the same. Each writer carves its nodes from its own slabs, so
+   threads share nothing but the nodes themselves. */
+struct dict_writer {
+   dict_hdr* h;
+   dict* top;          // Words are added below this node
+   slab* slabs;        // This writer's own arena
+   dict* spare;        // Node made for a race that was lost, kept for next time
+   int nodes;          // Nodes this writer added to the tree
+};
+
+dict_writer* dict_writer_new(dict* p)
+{
+   if (!p) {
+      return NULL;
+   }
+   dict_writer* w = (dict_writer*)calloc(1, sizeof(dict_writer));
+   if (!w) {
+      fprintf(stderr, "Memory allocation failed in dict_writer_new\n");
+      exit(EXIT_FAILURE);
+   }
+   w->h = dict_header(p);
+   w->top = p;
+
+   // Wait out the last writer's clean-up, if one is under way
+   int open = ATOMIC_LOAD(&w->h->writers);
+   while (open < 0 || !ATOMIC_CAS(&w->h->writers, open, open + 1)) {
+      if (open < 0) {
+         sched_yield();
+         open = ATOMIC_LOAD(&w->h->writers);
+      }
+   }
+   return w;
+}
+
+/* The child of p for letter slot i, made if need be. A child is
+   never added in place: a new block holding it replaces p's block
+   by compare-and-swap, so two threads racing to extend the same
+   node can't lose a child. Whoever loses the race reads the
+   winner's block and tries again, if the letter is still missing. */
+static dict* writer_child(dict_writer* w, dict* p, int i)
+{
+   for (;;) {
+      dict_kids* k = ATOMIC_LOAD(&p->dwn);
+      uint32_t mask = k ? k->mask : 0;
+      int at = POPCOUNT(mask & ((1u << i) - 1));
+      if ((mask >> i) & 1u) {
+         return k->kid[at];
+      }
+
+      dict* c = w->spare;
+      if (!c) {
+         c = (dict*)arena_alloc(&w->slabs, sizeof(dict));
+      }
+      c->up = p;
+      c->depth = p->depth + 1;
+      // Sized like child_add's blocks, so it can go on growing in place later
+      int n = POPCOUNT(mask);
+      dict_kids* g = (dict_kids*)arena_alloc(&w->slabs, sizeof(dict_kids) + ((size_t)1 << kids_class(n + 1)) * sizeof(dict*));
+      if (k) {
+         memcpy(g->kid, k->kid, (size_t)at * sizeof(dict*));
+         memcpy(&g->kid[at + 1], &k->kid[at], (size_t)(n - at) * sizeof(dict*));
+      }
+      g->kid[at] = c;
+      g->mask = mask | (1u << i);
+      if (ATOMIC_CAS(&p->dwn, k, g)) {
+         w->spare = NULL;
+         w->nodes++;
+         return c;
+      }
+      w->spare = c; // The block is lost to the arena; the node isn't
+   }
+}
+
+bool dict_writer_add(dict_writer* w, const char* wd)
+{
+   unsigned char slot[WORD_MAXLEN + 1];
+   if (!w || !wd || !norm_word(wd, strlen(wd), NULL, slot)) {
+      return false;
+   }
+   size_t len = strlen(wd);
+   if (w->top->depth + len > WORD_MAXLEN) {
+      return false;
+   }
+   dict* current = w->top;
+   for (size_t i = 0; i < len; i++) {
+      current = writer_child(w, current, slot[i]);
+   }
+   // A repeat word costs one atomic add. freq > 0 marks a word for now
+   return ATOMIC_ADD(&current->freq, 1) == 0;
+}
+
+/* Once every writer is done: set terminal from freq, and the
+   bests, totals and frequency order from scratch. A node's
+   children must be done first. */
+static void writer_sync_node(dict_hdr* h, dict* d)
+{
+   d->terminal = d->freq > 0;
+   if (d->terminal) {
+      h->words += d->freq;
+      if (d->freq > h->maxfreq) {
+         h->maxfreq = d->freq;
+      }
+      order_add(h, d);
+   }
+   d->best = (dict*)best_of(d->terminal ? d : NULL, best_below(d));
+}
+
+// writer_sync_node for d and everything below it
+static void writer_sync(dict_hdr* h, dict* d)
+{
+   if (d->dwn) {
+      for (int i = 0; i < POPCOUNT(d->dwn->mask); i++) {
+         writer_sync(h, d->dwn->kid[i]);
+      }
+   }
+   writer_sync_node(h, d);
+}
+
+static void writer_sync_task(void* acc, dict* node)
+{
+   writer_sync((dict_hdr*)acc, node);
+}
+
+/* writer_sync of the whole tree, on several threads if it is big.
+   Each thread gathers totals and words into a header of its own,
+   which are merged before the top two levels are done. */
+static void writer_sync_all(dict_hdr* h, int nthreads)
+{
+   if (nthreads < 2) {
+      writer_sync(h, &h->root);
+      return;
+   }
+   dict** task;
+   int n = par_tasks(&h->root, &task);
+   int used;
+   dict_hdr* acc = (dict_hdr*)par_run(task, n, nthreads, writer_sync_task, sizeof(dict_hdr), &used);
+   for (int t = 0; t < used; t++) {
+      h->words += acc[t].words;
+      if (acc[t].maxfreq > h->maxfreq) {
+         h->maxfreq = acc[t].maxfreq;
+      }
+      for (int j = 0; j < acc[t].ordered; j++) {
+         order_add(h, acc[t].order[j]);
+      }
+      free(acc[t].order);
+      free(acc[t].above);
+      free(acc[t].spill_node);
+      free(acc[t].spill_rank);
+   }
+   free(acc);
+   free(task);
+   dict* root = &h->root;
+   for (int i = 0; root->dwn && i < POPCOUNT(root->dwn->mask); i++) {
+      writer_sync_node(h, root->dwn->kid[i]);
+   }
+   writer_sync_node(h, root);
+}
+
+void dict_writer_free(dict_writer** w)
+{
+   if (!w || !*w) {
+      return;
+   }
+   dict_hdr* h = (*w)->h;
+
+   // Hand this writer's arena to the dictionary
+   slab* first = (*w)->slabs;
+   if (first) {
+      slab* last = first;
+      while (last->next) {
+         last = last->next;
+      }
+      slab* head = ATOMIC_LOAD(&h->writer_slabs);
+      do {
+         last->next = head;
+      } while (!ATOMIC_CAS(&h->writer_slabs, head, first));
+   }
+   ATOMIC_ADD(&h->nodes, (*w)->nodes);
+   free(*w);
+   *w = NULL;
+
+   /* The last writer out puts right everything the writers skipped,
+      holding off new writers (-1) meanwhile. */
+   int open = ATOMIC_LOAD(&h->writers);
+   while (!ATOMIC_CAS(&h->writers, open, open == 1 ? -1 : open - 1)) {
+   }
+   if (open != 1) {
+      return;
+   }
+   slab* s = h->writer_slabs;
+   h->writer_slabs = NULL;
+   while (s) {
+      slab* next = s->next;
+      // After ours, so ours stays the one in use
+      if (h->slabs) {
+         s->next = h->slabs->next;
+         h->slabs->next = s;
+      } else {
+         s->next = NULL;
+         h->slabs = s;
+      }
+      s = next;
+   }
+   h->words = 0;
+   h->maxfreq = 0;
+   h->ordered = 0;
+   writer_sync_all(h, par_threads(h->nodes));
+   order_rebuild(h);
+   ATOMIC_STORE(&h->writers, 0);
+}
+
+/* A dictionary whose readers never wait. No node of a published
+   version is changed again: adding a word copies the nodes on its
+   path (with their child blocks), from the word's own node up to a
+   new top node, and shares everything else with the version before.
+   Publishing the new top is one atomic store, so a reader sees the
+   old version or the new one, whole.
+
+   What a new version replaces is retired, not freed, as readers
+   may still be in an older one. Each reader pins the epoch it
+   starts in; whatever was retired in epoch e is freed once no
+   reader is pinned at e or before (epoch-based reclamation). */
+// Pins held at once; t27.h documents this limit
+#define VERS_READERS 64
+
+typedef struct vers_retired {
+   void* mem;
+   uint64_t epoch;                 // Epoch it was retired in
+} vers_retired;
+
+struct dict_versioned {
+   dict_hdr* top;                  // The current version (atomic)
+   uint64_t epoch;                 // Global epoch, from 1 (atomic)
+   uint64_t pinned[VERS_READERS];  // Epoch each ticket is pinned at, 0 if free (atomic)
+   pthread_mutex_t lock;           // Writers take turns
+   vers_retired* retired;          // Oldest first
+   int nretired;
+   int retired_cap;
+};
+
+dict_versioned* dict_versioned_new(void)
+{
+   dict_versioned* v = (dict_versioned*)calloc(1, sizeof(dict_versioned));
+   dict_hdr* h = (dict_hdr*)calloc(1, sizeof(dict_hdr));
+   if (!v || !h) {
+      fprintf(stderr, "Memory allocation failed in dict_versioned_new\n");
+      exit(EXIT_FAILURE);
+   }
+   h->nodes = 1;
+   v->top = h;
+   v->epoch = 1;
+   pthread_mutex_init(&v->lock, NULL);
+   return v;
+}
+
+// Copy of node o for a new version, or a new empty node if o is NULL
+static dict* vers_node(const dict* o)
+{
+   dict* n = (dict*)malloc(sizeof(dict));
+   if (!n) {
+      fprintf(stderr, "Memory allocation failed in vers_node\n");
+      exit(EXIT_FAILURE);
+   }
+   if (o) {
+      *n = *o;
+   } else {
+      memset(n, 0, sizeof(dict));
+   }
+   return n;
+}
+
+/* Copy of child block k (NULL for none) with c as the child for
+   slot i, in place of the old one or added in order. Blocks of
+   a version never grow, so each is exactly the size it needs. */
+static dict_kids* vers_kids(const dict_kids* k, int i, dict* c)
+{
+   uint32_t mask = k ? k->mask : 0;
+   int n = POPCOUNT(mask);
+   int at = POPCOUNT(mask & ((1u << i) - 1));
+   int had = (mask >> i) & 1u;
+   dict_kids* g = (dict_kids*)malloc(sizeof(dict_kids) + (size_t)(n + 1 - had) * sizeof(dict*));
+   if (!g) {
+      fprintf(stderr, "Memory allocation failed in vers_kids\n");
+      exit(EXIT_FAILURE);
+   }
+   if (k) {
+      memcpy(g->kid, k->kid, (size_t)at * sizeof(dict*));
+      memcpy(&g->kid[at + 1], &k->kid[at + had], (size_t)(n - at - had) * sizeof(dict*));
+   }
+   g->kid[at] = c;
+   g->mask = mask | (1u << i);
+   return g;
+}
+
+// Keeps mem until no reader can be in a version from before 'epoch'
+static void vers_retire(dict_versioned* v, void* mem, uint64_t epoch)
+{
+   if (!mem) {
+      return;
+   }
+   if (v->nretired == v->retired_cap) {
+      v->retired_cap = v->retired_cap ? v->retired_cap * 2 : 64;
+      v->retired = (vers_retired*)realloc(v->retired, (size_t)v->retired_cap * sizeof(vers_retired));
+      if (!v->retired) {
+         fprintf(stderr, "Memory allocation failed in vers_retire\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   v->retired[v->nretired].mem = mem;
+   v->retired[v->nretired].epoch = epoch;
+   v->nretired++;
+}
+
+/* Frees what was retired before the oldest pinned epoch. A reader
+   pins, then loads the top; a writer publishes, then looks at the
+   pins. With a fence between each pair, a reader this misses has
+   already been given the newer top. */
+static void vers_reclaim(dict_versioned* v)
+{
+   ATOMIC_FENCE();
+   uint64_t oldest = UINT64_MAX;
+   for (int i = 0; i < VERS_READERS; i++) {
+      uint64_t e = ATOMIC_LOAD(&v->pinned[i]);
+      if (e && e < oldest) {
+         oldest = e;
+      }
+   }
+   int kept = 0;
+   for (int i = 0; i < v->nretired; i++) {
+      if (v->retired[i].epoch < oldest) {
+         free(v->retired[i].mem);
+      } else {
+         v->retired[kept++] = v->retired[i];
+      }
+   }
+   v->nretired = kept;
+}
+
+bool dict_versioned_add(dict_versioned* v, const char* wd)
+{
+   unsigned char slot[WORD_MAXLEN + 1];
+   if (!v || !wd || !norm_word(wd, strlen(wd), NULL, slot)) {
+      return false;
+   }
+   size_t len = strlen(wd);
+   pthread_mutex_lock(&v->lock);
+   dict_hdr* oh = v->top; // Only changed under the lock
+
+   // The word's path as it is: old[0 .. have] exist
+   const dict* old[WORD_MAXLEN + 1];
+   old[0] = &oh->root;
+   size_t have = 0;
+   while (have < len && (old[have + 1] = dict_child(old[have], slot[have]))) {
+      have++;
+   }
+
+   // The word's node, which keeps its children
+   dict* c = vers_node(have == len ? old[len] : NULL);
+   c->depth = (unsigned)len;
+   bool added = !c->terminal;
+   c->terminal = true;
+   c->freq++;
+   c->best = (dict*)best_of(c, best_below(c));
+   int freq = c->freq;
+   int made = have < len;
+
+   // Then each node above it, up to a new top, with the new child
+   dict_hdr* nh = (dict_hdr*)malloc(sizeof(dict_hdr));
+   if (!nh) {
+      fprintf(stderr, "Memory allocation failed in dict_versioned_add\n");
+      exit(EXIT_FAILURE);
+   }
+   *nh = *oh;
+   for (size_t i = len; i-- > 0;) {
+      dict* p = &nh->root;
+      if (i > 0) {
+         p = vers_node(i <= have ? old[i] : NULL);
+         p->depth = (unsigned)i;
+         made += i > have;
+      }
+      p->dwn = vers_kids(i <= have ? old[i]->dwn : NULL, slot[i], c);
+      c->up = p;
+      p->best = (dict*)best_of(p->terminal ? p : NULL, best_below(p));
+      c = p;
+   }
+   nh->words++;
+   nh->nodes += made;
+   if (freq > nh->maxfreq) {
+      nh->maxfreq = freq;
+   }
+
+   // Publish, then retire what only older versions use
+   uint64_t e = ATOMIC_LOAD(&v->epoch);
+   ATOMIC_STORE(&v->top, nh);
+   vers_retire(v, oh->root.dwn, e);
+   vers_retire(v, oh, e);
+   for (size_t i = 1; i <= have; i++) {
+      if (i < len) {
+         vers_retire(v, old[i]->dwn, e);
+      }
+      vers_retire(v, (void*)old[i], e);
+   }
+   ATOMIC_ADD(&v->epoch, 1);
+   vers_reclaim(v);
+   pthread_mutex_unlock(&v->lock);
+   return added;
+}
+
+const dict* dict_versioned_pin(dict_versioned* v, int* ticket)
+{
+   if (!ticket) {
+      return NULL;
+   }
+   *ticket = -1; // Which dict_versioned_unpin ignores
+   if (!v) {
+      return NULL;
+   }
+   // Take a free ticket, waiting if every one is in use
+   for (int i = 0;; i = (i + 1) % VERS_READERS) {
+      uint64_t none = 0;
+      if (ATOMIC_LOAD(&v->pinned[i]) == 0 && ATOMIC_CAS(&v->pinned[i], none, ATOMIC_LOAD(&v->epoch))) {
+         *ticket = i;
+         break;
+      }
+      if (i == VERS_READERS - 1) {
+         sched_yield();
+      }
+   }
+   ATOMIC_FENCE();
+   return &ATOMIC_LOAD(&v->top)->root;
+}
+
+void dict_versioned_unpin(dict_versioned* v, int ticket)
+{
+   if (v && ticket >= 0 && ticket < VERS_READERS) {
+      ATOMIC_STORE(&v->pinned[ticket], (uint64_t)0);
+   }
+}
+
+// Frees the nodes and blocks below d, all of them the current version's
+static void vers_free_below(dict* d)
+{
+   if (d->dwn) {
+      for (int i = 0; i < POPCOUNT(d->dwn->mask); i++) {
+         vers_free_below(d->dwn->kid[i]);
+         free(d->dwn->kid[i]);
+      }
+      free(d->dwn);
+   }
+}
+
+void dict_versioned_free(dict_versioned** v)
+{
+   if (!v || !*v) {
+      return;
+   }
+   vers_free_below(&(*v)->top->root);
+   free((*v)->top);
+   for (int i = 0; i < (*v)->nretired; i++) {
+      free((*v)->retired[i].mem);
+   }
+   free((*v)->retired);
+   pthread_mutex_destroy(&(*v)->lock);
+   free(*v);
+   *v = NULL;
+}
+
+void dict_free(dict** d)
+{
+   // Check if the pointer to the dictionary or its content is NULL.
+   if (d == NULL) {
+      return;
+   }
+   if (*d == NULL) {
+      return;
+   }
+
+   // Nodes belong to their dictionary's arena, so only the
+   // root releases memory: every slab, then the header.
+   if ((*d)->up == NULL) {
+      dict_hdr* h = (dict_hdr*)*d;
+      slab* s = h->slabs;
+      while (s) {
+         slab* next = s->next;
+         free(s);
+         s = next;
+      }
+      free(h->order);
+      free(h->above);
+      free(h->spill_node);
+      free(h->spill_rank);
+      free(h);
+   }
+
+   // Set the dictionary pointer to NULL to avoid dangling pointers.
+   *d = NULL;
+}
+
+int dict_wordcount(const dict* p)
+{
+   // Base case: If the node is NULL, it does not contribute to the count.
+   if (p == NULL) {
+      return 0;
+   }
+
+   // The top node keeps a running total.
+   if (p->up == NULL) {
+      return ((const dict_hdr*)p)->words;
+   }
+
+   // Near the top, in one walk (on several threads if big)
+   tree_stats s;
+   if (stats_big(p, &s)) {
+      return s.words;
+   }
+
+   // Initialize the count with the frequency of this node, if it is terminal.
+   int count = 0;
+   if (p->terminal) {
+      count = p->freq;
+   }
+
+   // Recursively add the word counts of all child nodes.
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         count += dict_wordcount(p->dwn->kid[i]);
+      }
+   }
+
+   // Return the total word count for this node and its children.
+   return count;
+}
+
+
+int dict_nodecount(const dict* p)
+{
+   // Base case: If the node is NULL, it does not contribute to the count.
+   if (p == NULL) {
+      return 0;
+   }
+
+   // The top node keeps a running total.
+   if (p->up == NULL) {
+      return ((const dict_hdr*)p)->nodes;
+   }
+
+   // Near the top, in one walk (on several threads if big)
+   tree_stats s;
+   if (stats_big(p, &s)) {
+      return s.nodes;
+   }
+
+   // Initialize the count for the current node.
+   int count = 1;
+
+   // Recursively add the counts of all child nodes.
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         count += dict_nodecount(p->dwn->kid[i]);
+      }
+   }
+
+   // Return the total node count for this node and its children.
+   return count;
+}
+
+
+/**
+ * Checks if a word exists in the dictionary tree.
+ * Returns the terminal node if the word exists, NULL otherwise.
+ */
+dict* dict_spell(const dict* p, const char* str)
+{
+   // Return NULL if the input dictionary or string is invalid
+   if (!p || !str || !*str) {
+      return NULL;
+   }
+
+   const dict* current = p;
+
+   // Traverse the tree character by character
+   while (*str) {
+      // Calculate the index for the current character
+      int index = word_slot(*str);
+
+      // If the character is invalid or the child node doesn't exist, return NULL
+      if (index < 0 || !(current = dict_child(current, index))) {
+         return NULL;
+      }
+
+      // Move to the next node
+      str++;
+   }
+
+   // Return the node if it is a terminal node, otherwise NULL
+   return current->terminal ? (dict*)current : NULL;
+}
+
+
+/* dict_spell_batch keeps several lookups in flight and moves
+   each one a letter per round. Stepping into a child prefetches
+   it, and by the time that lane comes round again the other
+   lanes' steps have covered the wait for it. */
+typedef struct spell_lane {
+   const dict* node;
+   const char* str;  // Letters still to follow
+   int word;         // Which word this is
+} spell_lane;
+
+// Starts lane ln on the next word that needs a walk; false if none is left
+static bool spell_lane_fill(spell_lane* ln, const dict* p, const char* const* words, int n,
+                            int* next, dict** results)
+{
+   while (*next < n) {
+      const char* str = words[*next];
+      if (p && str && *str) {
+         ln->node = p;
+         ln->str = str;
+         ln->word = (*next)++;
+         return true;
+      }
+      results[(*next)++] = NULL;
+   }
+   return false;
+}
+
+void dict_spell_batch(const dict* p, const char* const* words, int n, dict** results)
+{
+   if (!words || !results) {
+      return;
+   }
+   spell_lane lane[BATCH_LANES];
+   int next = 0;
+   int busy = 0;
+   while (busy < BATCH_LANES && spell_lane_fill(&lane[busy], p, words, n, &next, results)) {
+      busy++;
+   }
+
+   while (busy > 0) {
+      for (int l = 0; l < busy; l++) {
+         spell_lane* ln = &lane[l];
+         const dict* node = ln->node;
+         char c = *ln->str;
+         const dict* found = NULL;
+
+         if (c) {
+            // One letter down, fetching the child for next round
+            int index = word_slot(c);
+            const dict_kids* k = node->dwn;
+            if (index >= 0 && k && ((k->mask >> index) & 1u)) {
+               ln->node = k->kid[POPCOUNT(k->mask & ((1u << index) - 1))];
+               ln->str++;
+               PREFETCH(ln->node);
+               continue;
+            }
+         } else if (node->terminal) {
+            found = node;
+         }
+
+         // Done: hand the lane to the next word, or retire it
+         results[ln->word] = (dict*)found;
+         if (!spell_lane_fill(ln, p, words, n, &next, results)) {
+            lane[l--] = lane[--busy];
+         }
+      }
+   }
+}
+
+
+int dict_mostcommon(const dict* p)
+{
+   // Base case: If the node is NULL, it cannot have a frequency.
+   if (!p) {
+      return 0;
+   }
+
+   // The top node keeps a running maximum.
+   if (p->up == NULL) {
+      return ((const dict_hdr*)p)->maxfreq;
+   }
+
+   // Near the top, in one walk (on several threads if big)
+   tree_stats s;
+   if (stats_big(p, &s)) {
+      return s.maxfreq;
+   }
+
+   // Start with the frequency of this node if it is terminal.
+   int max_freq = p->terminal ? p->freq : 0;
+
+   // Recursively find the maximum frequency in child nodes.
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         int child_freq = dict_mostcommon(p->dwn->kid[i]);
+         if (child_freq > max_freq) {
+            max_freq = child_freq;
+         }
+      }
+   }
+
+   // Return the maximum frequency found.
+   return max_freq;
+}
+
+
+// CHALLENGE1
+unsigned dict_cmp(dict* p1, dict* p2)
+{
+   if (!p1 || !p2) {
+      return 0; // If either node is NULL, return 0
+   }
+
+   // Each node knows its depth, so only the steps up are walked
+   unsigned total_distance = 0;
+
+   // Bring both nodes to the same depth
+   while (p1->depth > p2->depth) {
+      p1 = p1->up;
+      total_distance++;
+   }
+   while (p2->depth > p1->depth) {
+      p2 = p2->up;
+      total_distance++;
+   }
+
+   // Move both nodes up until they meet at a common ancestor
+   while (p1 != p2) {
+      p1 = p1->up;
+      p2 = p2->up;
+      total_distance += 2; // Increment for each step up
+   }
+
+   return total_distance;
+}
+
+/* The index behind dict_lca_cmp. The tree's Euler tour lists each
+   node on the way down and again after each of its children; the
+   deepest common ancestor of two nodes is then the shallowest node
+   visited between their first visits. 'least' holds the least depth
+   over every run of the tour a power of two long, so any stretch is
+   covered by two overlapping runs. Nodes are found in the tour
+   through a hash of their addresses. */
+struct dict_lca {
+   const dict** key;   // Open addressing, NULL where empty
+   uint32_t* first;    // Where key[j] is first visited
+   uint32_t mask;
+   uint32_t len;       // Length of the tour
+   int levels;
+   uint8_t* least;     // least[k * len + i]: least depth in tour[i .. i + 2^k)
+};
+
+static uint32_t lca_hash(const dict_lca* x, const dict* d)
+{
+   return (uint32_t)(((uint64_t)(uintptr_t)d * 0x9E3779B97F4A7C15ull) >> 32) & x->mask;
+}
+
+// Where node d is first visited, or -1 if it isn't in the index
+static int64_t lca_find(const dict_lca* x, const dict* d)
+{
+   for (uint32_t j = lca_hash(x, d); x->key[j]; j = (j + 1) & x->mask) {
+      if (x->key[j] == d) {
+         return x->first[j];
+      }
+   }
+   return -1;
+}
+
+static void lca_tour(dict_lca* x, const dict* d, uint32_t* at)
+{
+   uint32_t j = lca_hash(x, d);
+   while (x->key[j]) {
+      j = (j + 1) & x->mask;
+   }
+   x->key[j] = d;
+   x->first[j] = *at;
+   x->least[(*at)++] = (uint8_t)d->depth;
+   if (d->dwn) {
+      for (int i = 0; i < POPCOUNT(d->dwn->mask); i++) {
+         lca_tour(x, d->dwn->kid[i], at);
+         x->least[(*at)++] = (uint8_t)d->depth;
+      }
+   }
+}
+
+dict_lca* dict_lca_build(const dict* p)
+{
+   if (!p) {
+      return NULL;
+   }
+   uint32_t n = (uint32_t)dict_nodecount(p);
+   dict_lca* x = (dict_lca*)calloc(1, sizeof(dict_lca));
+   if (!x) {
+      fprintf(stderr, "Memory allocation failed in dict_lca_build\n");
+      exit(EXIT_FAILURE);
+   }
+   uint32_t cap = 16;
+   while (cap < 2 * n) {
+      cap *= 2;
+   }
+   x->mask = cap - 1;
+   x->len = 2 * n - 1;
+   x->levels = LOG2(x->len) + 1;
+   x->key = (const dict**)calloc(cap, sizeof(dict*));
+   x->first = (uint32_t*)malloc(cap * sizeof(uint32_t));
+   x->least = (uint8_t*)malloc((size_t)x->levels * x->len);
+   if (!x->key || !x->first || !x->least) {
+      fprintf(stderr, "Memory allocation failed in dict_lca_build\n");
+      exit(EXIT_FAILURE);
+   }
+
+   uint32_t at = 0;
+   lca_tour(x, p, &at);
+   for (int k = 1; k < x->levels; k++) {
+      const uint8_t* lo = x->least + (size_t)(k - 1) * x->len;
+      uint8_t* up = x->least + (size_t)k * x->len;
+      uint32_t half = 1u << (k - 1);
+      for (uint32_t i = 0; i + 2 * half <= x->len; i++) {
+         up[i] = lo[i] < lo[i + half] ? lo[i] : lo[i + half];
+      }
+   }
+   return x;
+}
+
+unsigned dict_lca_cmp(const dict_lca* x, const dict* p1, const dict* p2)
+{
+   if (!p1 || !p2) {
+      return 0;
+   }
+   int64_t i = x ? lca_find(x, p1) : -1;
+   int64_t j = x ? lca_find(x, p2) : -1;
+   if (i < 0 || j < 0) {
+      return dict_cmp((dict*)p1, (dict*)p2); // Not indexed: the long way
+   }
+   if (i > j) {
+      int64_t t = i;
+      i = j;
+      j = t;
+   }
+   int k = LOG2((uint32_t)(j - i + 1));
+   const uint8_t* run = x->least + (size_t)k * x->len;
+   uint8_t a = run[i];
+   uint8_t b = run[j - (1 << k) + 1];
+   return p1->depth + p2->depth - 2u * (a < b ? a : b);
+}
+
+void dict_lca_free(dict_lca** x)
+{
+   if (!x || !*x) {
+      return;
+   }
+   free((*x)->key);
+   free((*x)->first);
+   free((*x)->least);
+   free(*x);
+   *x = NULL;
+}
+
+// CHALLENGE2
+void dict_autocomplete(const dict* p, const char* wd, char* ret)
+{
+   if (!p || !wd) {
+      *ret = '\0'; // Invalid input, return empty string
+      return;
+   }
+
+   const dict* current = p;
+
+   // Traverse the prefix
+   while (*wd) {
+      int index = word_slot(*wd);
+      if (index < 0 || !(current = dict_child(current, index))) {
+         *ret = '\0'; // Prefix not found
+         return;
+      }
+      wd++;
+   }
+
+   // The cached best word below the prefix (not the prefix itself)
+   const dict* target = best_below(current);
+
+   // Follow the child holding 'target' down to it, writing its letters
+   int n = 0;
+   while (target && current != target) {
+      const dict_kids* k = current->dwn;
+      int j = 0;
+      for (int i = 0; i < ALPHA; i++) {
+         if ((k->mask >> i) & 1u) {
+            const dict* c = k->kid[j++];
+            if (c->best == target) {
+               ret[n++] = (i == ALPHA - 1) ? '\'' : 'a' + i;
+               current = c;
+               break;
+            }
+         }
+      }
+   }
+   ret[n] = '\0';
+}
+
+
+/* A frozen dictionary is a minimal acyclic word graph: nodes
+   with identical futures (same words below them) are stored
+   once, so shared endings like "-ing" exist a single time. The
+   frequencies can't live in shared nodes, so each node instead
+   counts the words at or below it. The number of words passed
+   on the way down then gives a word's position in dictionary
+   order, which indexes 'freq'. */
+#define DAWG_TERMINAL 0x80000000u
+#define DAWG_SLOT_BITS 5
+
+typedef struct dawg_node {
+   uint32_t first; // First of its edges, which run up to the next node's
+   uint32_t words; // Words at or below it, DAWG_TERMINAL set if it ends one
+} dawg_node;
+
+struct dict_frozen {
+   dawg_node* node;  // node[nnodes] is a sentinel closing the last edges
+   uint32_t* edge;   // Target node << DAWG_SLOT_BITS | letter slot
+   int* freq;        // Frequency of each word, in dictionary order
+   int nnodes;
+   int nedges;
+   int nwords;
+   int maxlen;       // Longest word, for enumeration buffers
+   uint32_t root;
+};
+
+// State while freezing: the graph so far and a table of its nodes
+typedef struct freeze_job {
+   dict_frozen* f;
+   uint32_t* table; // Node number + 1 per slot, 0 if empty
+   size_t mask;     // Table size - 1
+} freeze_job;
+
+static uint32_t dawg_hash(uint32_t words, const uint32_t* edge, int n)
+{
+   uint32_t x = words * 0x9E3779B1u;
+   for (int i = 0; i < n; i++) {
+      x = (x ^ edge[i]) * 0x85EBCA6Bu;
+      x ^= x >> 15;
+   }
+   return x;
+}
+
+// Freezes the subtree at p (children first), returning its graph node
+static uint32_t freeze_node(freeze_job* z, const dict* p, int depth)
+{
+   dict_frozen* f = z->f;
+   uint32_t edge[ALPHA];
+   int n = 0;
+   uint32_t words = p->terminal ? 1 : 0;
+   if (depth > f->maxlen) {
+      f->maxlen = depth;
+   }
+
+   const dict_kids* k = p->dwn;
+   for (int i = 0; k && i < ALPHA; i++) {
+      if ((k->mask >> i) & 1u) {
+         uint32_t c = freeze_node(z, k->kid[n], depth + 1);
+         words += f->node[c].words & ~DAWG_TERMINAL;
+         edge[n++] = c << DAWG_SLOT_BITS | (uint32_t)i;
+      }
+   }
+   if (p->terminal) {
+      words |= DAWG_TERMINAL;
+   }
+
+   // An identical node already frozen stands in for this one
+   size_t at = dawg_hash(words, edge, n) & z->mask;
+   for (; z->table[at]; at = (at + 1) & z->mask) {
+      uint32_t id = z->table[at] - 1;
+      const dawg_node* d = &f->node[id];
+      if (d->words == words && (int)(d[1].first - d->first) == n
+          && memcmp(&f->edge[d->first], edge, (size_t)n * sizeof(uint32_t)) == 0) {
+         return id;
+      }
+   }
+
+   // Otherwise add it, its edges following the last node's
+   uint32_t id = (uint32_t)f->nnodes++;
+   f->node[id].first = (uint32_t)f->nedges;
+   f->node[id].words = words;
+   memcpy(&f->edge[f->nedges], edge, (size_t)n * sizeof(uint32_t));
+   f->nedges += n;
+   f->node[id + 1].first = (uint32_t)f->nedges;
+   z->table[at] = id + 1;
+   return id;
+}
+
+// Lists the frequencies of the words at or below p, in dictionary order
+static void freeze_freqs(const dict* p, int* freq, int* n)
+{
+   if (p->terminal) {
+      freq[(*n)++] = p->freq;
+   }
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         freeze_freqs(p->dwn->kid[i], freq, n);
+      }
+   }
+}
+
+dict_frozen* dict_freeze(const dict* p)
+{
+   if (!p) {
+      return NULL;
+   }
+
+   // Never more graph nodes or edges than the tree has nodes
+   int nodes = dict_nodecount(p);
+   size_t size = 2;
+   while (size < 2 * (size_t)nodes) {
+      size *= 2;
+   }
+   freeze_job z;
+   dict_frozen* f = (dict_frozen*)calloc(1, sizeof(dict_frozen));
+   z.table = (uint32_t*)calloc(size, sizeof(uint32_t));
+   z.mask = size - 1;
+   z.f = f;
+   if (!f || !z.table) {
+      fprintf(stderr, "Memory allocation failed in dict_freeze\n");
+      exit(EXIT_FAILURE);
+   }
+   f->node = (dawg_node*)malloc(((size_t)nodes + 1) * sizeof(dawg_node));
+   f->edge = (uint32_t*)malloc((size_t)nodes * sizeof(uint32_t));
+   if (!f->node || !f->edge) {
+      fprintf(stderr, "Memory allocation failed in dict_freeze\n");
+      exit(EXIT_FAILURE);
+   }
+   f->node[0].first = 0;
+   f->root = freeze_node(&z, p, 0);
+   free(z.table);
+
+   // Give back what the minimised graph didn't need
+   f->node = (dawg_node*)realloc(f->node, ((size_t)f->nnodes + 1) * sizeof(dawg_node));
+   if (f->nedges) {
+      f->edge = (uint32_t*)realloc(f->edge, (size_t)f->nedges * sizeof(uint32_t));
+   }
+
+   f->nwords = (int)(f->node[f->root].words & ~DAWG_TERMINAL);
+   f->freq = (int*)malloc(((size_t)f->nwords + 1) * sizeof(int));
+   if (!f->freq) {
+      fprintf(stderr, "Memory allocation failed in dict_freeze\n");
+      exit(EXIT_FAILURE);
+   }
+   int n = 0;
+   freeze_freqs(p, f->freq, &n);
+   return f;
+}
+
+/* Follows wd down from the top, counting in 'rank' the words
+   passed on the way. Returns the node reached, or -1. */
+static int64_t dawg_walk(const dict_frozen* f, const char* wd, uint32_t* rank)
+{
+   uint32_t u = f->root;
+   uint32_t r = 0;
+   for (; *wd; wd++) {
+      int index = word_slot(*wd);
+      if (index < 0) {
+         return -1;
+      }
+      const dawg_node* d = &f->node[u];
+      if (d->words & DAWG_TERMINAL) {
+         r++; // The word ending here comes first
+      }
+      uint32_t e = d->first;
+      for (; e < d[1].first; e++) {
+         uint32_t slot = f->edge[e] & ((1u << DAWG_SLOT_BITS) - 1);
+         uint32_t to = f->edge[e] >> DAWG_SLOT_BITS;
+         if (slot == (uint32_t)index) {
+            u = to;
+            break;
+         }
+         r += f->node[to].words & ~DAWG_TERMINAL;
+      }
+      if (e == d[1].first) {
+         return -1;
+      }
+   }
+   *rank = r;
+   return u;
+}
+
+int dict_frozen_freq(const dict_frozen* f, const char* wd)
+{
+   if (!f || !wd || !*wd) {
+      return 0;
+   }
+   uint32_t rank;
+   int64_t u = dawg_walk(f, wd, &rank);
+   if (u < 0 || !(f->node[u].words & DAWG_TERMINAL)) {
+      return 0;
+   }
+   return f->freq[rank];
+}
+
+bool dict_frozen_spell(const dict_frozen* f, const char* wd)
+{
+   return dict_frozen_freq(f, wd) > 0;
+}
+
+int dict_frozen_nodecount(const dict_frozen* f)
+{
+   return f ? f->nnodes : 0;
+}
+
+// Calls back with every word at or below node u, whose letters so far are in buf
+static void dawg_list(const dict_frozen* f, uint32_t u, char* buf, int len, uint32_t* rank,
+                      void (*cb)(const char* wd, int freq, void* arg), void* arg)
+{
+   const dawg_node* d = &f->node[u];
+   if (d->words & DAWG_TERMINAL) {
+      buf[len] = '\0';
+      cb(buf, f->freq[(*rank)++], arg);
+   }
+   for (uint32_t e = d->first; e < d[1].first; e++) {
+      uint32_t slot = f->edge[e] & ((1u << DAWG_SLOT_BITS) - 1);
+      buf[len] = (slot == ALPHA - 1) ? '\'' : (char)('a' + slot);
+      dawg_list(f, f->edge[e] >> DAWG_SLOT_BITS, buf, len + 1, rank, cb, arg);
+   }
+}
+
+int dict_frozen_prefix(const dict_frozen* f, const char* wd,
+                       void (*cb)(const char* wd, int freq, void* arg), void* arg)
+{
+   if (!f || !wd || !cb) {
+      return 0;
+   }
+   uint32_t rank;
+   int64_t u = dawg_walk(f, wd, &rank);
+   if (u < 0) {
+      return 0;
+   }
+   size_t len = strlen(wd);
+   char* buf = (char*)malloc(len + (size_t)f->maxlen + 1);
+   if (!buf) {
+      fprintf(stderr, "Memory allocation failed in dict_frozen_prefix\n");
+      exit(EXIT_FAILURE);
+   }
+   // The walk checked every character, so setting 0x20 lowercases it
+   for (size_t i = 0; i < len; i++) {
+      buf[i] = (char)(wd[i] | 0x20);
+   }
+   uint32_t start = rank;
+   dawg_list(f, (uint32_t)u, buf, (int)len, &rank, cb, arg);
+   free(buf);
+   return (int)(rank - start);
+}
+
+void dict_frozen_free(dict_frozen** f)
+{
+   if (!f || !*f) {
+      return;
+   }
+   free((*f)->node);
+   free((*f)->edge);
+   free((*f)->freq);
+   free(*f);
+   *f = NULL;
+}
+
+/* Snapshot file: a header, then every node in breadth-first
+   order so that each node's children sit next to each other.
+   Nodes refer to each other by number, never by address, so
+   the file works wherever it is mapped. */
+#define IMAGE_MAGIC "T27DICT"
+#define IMAGE_VERSION 1
+#define IMAGE_NONE 0xFFFFFFFFu
+
+typedef struct image_hdr {
+   char magic[8];
+   uint32_t version;
+   uint32_t endian;   // 0x01020304 as written, to spot foreign byte order
+   uint32_t nnodes;
+   int32_t words;
+   int32_t maxfreq;
+   uint32_t spare;
+} image_hdr;
+
+typedef struct image_node {
+   uint32_t mask;     // Children present, as in dict_kids
+   uint32_t first;    // Number of the first child; the rest follow it
+   uint32_t best;     // Best word at or below, as in dict's 'best'
+   int32_t freq;      // 0 unless a word ends here
+} image_node;
+
+struct dict_mapped {
+   const void* map;
+   size_t size;
+   const image_hdr* hdr;
+   const image_node* node;
+};
+
+bool dict_save(const dict* p, const char* fname)
+{
+   if (!p || !fname) {
+      return false;
+   }
+
+   // Number the nodes breadth first
+   int n = dict_nodecount(p);
+   const dict** order = (const dict**)malloc((size_t)n * sizeof(dict*));
+   image_node* img = (image_node*)calloc((size_t)n, sizeof(image_node));
+   if (!order || !img) {
+      fprintf(stderr, "Memory allocation failed in dict_save\n");
+      exit(EXIT_FAILURE);
+   }
+   int tail = 0;
+   order[tail++] = p;
+   for (int i = 0; i < n; i++) {
+      const dict* q = order[i];
+      img[i].freq = q->terminal ? q->freq : 0;
+      img[i].first = (uint32_t)tail;
+      if (q->dwn) {
+         img[i].mask = q->dwn->mask;
+         for (int j = 0; j < POPCOUNT(q->dwn->mask); j++) {
+            order[tail++] = q->dwn->kid[j];
+         }
+      }
+   }
+
+   // Best words, children before parents, by the same rule as best_update
+   for (int i = n - 1; i >= 0; i--) {
+      uint32_t b = img[i].freq ? (uint32_t)i : IMAGE_NONE;
+      for (int j = 0; j < POPCOUNT(img[i].mask); j++) {
+         uint32_t c = img[img[i].first + j].best;
+         if (c != IMAGE_NONE && (b == IMAGE_NONE || img[c].freq > img[b].freq)) {
+            b = c;
+         }
+      }
+      img[i].best = b;
+   }
+
+   image_hdr hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+   hdr.version = IMAGE_VERSION;
+   hdr.endian = 0x01020304u;
+   hdr.nnodes = (uint32_t)n;
+   hdr.words = dict_wordcount(p);
+   hdr.maxfreq = dict_mostcommon(p);
+
+   bool ok = false;
+   FILE* fp = fopen(fname, "wb");
+   if (fp) {
+      ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+           && fwrite(img, sizeof(image_node), (size_t)n, fp) == (size_t)n;
+      ok = (fclose(fp) == 0) && ok;
+   }
+   free(order);
+   free(img);
+   return ok;
+}
+
+dict_mapped* dict_open_mapped(const char* fname)
+{
+   if (!fname) {
+      return NULL;
+   }
+   int fd = open(fname, O_RDONLY);
+   if (fd < 0) {
+      return NULL;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(image_hdr)) {
+      close(fd);
+      return NULL;
+   }
+   size_t size = (size_t)st.st_size;
+   // Shared, so every process mapping the file uses the same pages
+   void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      return NULL;
+   }
+
+   const image_hdr* hdr = (const image_hdr*)map;
+   if (memcmp(hdr->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 || hdr->version != IMAGE_VERSION
+       || hdr->endian != 0x01020304u || hdr->nnodes == 0
+       || size != sizeof(image_hdr) + (size_t)hdr->nnodes * sizeof(image_node)) {
+      munmap(map, size);
+      return NULL;
+   }
+
+   dict_mapped* m = (dict_mapped*)malloc(sizeof(dict_mapped));
+   if (!m) {
+      fprintf(stderr, "Memory allocation failed in dict_open_mapped\n");
+      exit(EXIT_FAILURE);
+   }
+   m->map = map;
+   m->size = size;
+   m->hdr = hdr;
+   m->node = (const image_node*)(hdr + 1);
+   return m;
+}
+
+/* Number of the j-th child of node u, or IMAGE_NONE if the file
+   points outside itself. Only the header is checked at open, so
+   every number read from a node is checked here; children always
+   come after their parent, which also rules out loops. */
+static inline uint32_t mapped_child(const dict_mapped* m, uint32_t u, int j)
+{
+   uint64_t c = (uint64_t)m->node[u].first + (uint64_t)j;
+   return c > u && c < m->hdr->nnodes ? (uint32_t)c : IMAGE_NONE;
+}
+
+// Node u's best word, or IMAGE_NONE if it has none (or a bad one)
+static inline uint32_t mapped_best(const dict_mapped* m, uint32_t u)
+{
+   uint32_t b = m->node[u].best;
+   return b < m->hdr->nnodes ? b : IMAGE_NONE;
+}
+
+// Number of the node reached by following wd down from the top, or IMAGE_NONE
+static uint32_t mapped_walk(const dict_mapped* m, const char* wd)
+{
+   uint32_t u = 0;
+   for (; *wd && u != IMAGE_NONE; wd++) {
+      int index = word_slot(*wd);
+      if (index < 0) {
+         return IMAGE_NONE;
+      }
+      uint32_t mask = m->node[u].mask;
+      if (!((mask >> index) & 1u)) {
+         return IMAGE_NONE;
+      }
+      u = mapped_child(m, u, POPCOUNT(mask & ((1u << index) - 1)));
+   }
+   return u;
+}
+
+int dict_mapped_freq(const dict_mapped* m, const char* wd)
+{
+   if (!m || !wd || !*wd) {
+      return 0;
+   }
+   uint32_t u = mapped_walk(m, wd);
+   return u == IMAGE_NONE ? 0 : m->node[u].freq;
+}
+
+bool dict_mapped_spell(const dict_mapped* m, const char* wd)
+{
+   return dict_mapped_freq(m, wd) > 0;
+}
+
+int dict_mapped_wordcount(const dict_mapped* m)
+{
+   return m ? m->hdr->words : 0;
+}
+
+void dict_mapped_autocomplete(const dict_mapped* m, const char* wd, char* ret)
+{
+   *ret = '\0';
+   if (!m || !wd) {
+      return;
+   }
+   uint32_t u = mapped_walk(m, wd);
+   if (u == IMAGE_NONE) {
+      return;
+   }
+
+   // The best word below the prefix: the best of its children's
+   const image_node* node = m->node;
+   uint32_t target = IMAGE_NONE;
+   for (int j = 0; j < POPCOUNT(node[u].mask); j++) {
+      uint32_t c = mapped_child(m, u, j);
+      c = c == IMAGE_NONE ? c : mapped_best(m, c);
+      if (c != IMAGE_NONE && (target == IMAGE_NONE || node[c].freq > node[target].freq)) {
+         target = c;
+      }
+   }
+
+   // Follow the child holding it down, writing its letters
+   int n = 0;
+   while (target != IMAGE_NONE && u != target && n < WORD_MAXLEN) {
+      uint32_t next = IMAGE_NONE;
+      int j = 0;
+      for (int i = 0; i < ALPHA && next == IMAGE_NONE; i++) {
+         if ((node[u].mask >> i) & 1u) {
+            uint32_t c = mapped_child(m, u, j++);
+            if (c != IMAGE_NONE && node[c].best == target) {
+               ret[n++] = (i == ALPHA - 1) ? '\'' : 'a' + i;
+               next = c;
+            }
+         }
+      }
+      if (next == IMAGE_NONE) {
+         n = 0; // Only in a damaged file
+         break;
+      }
+      u = next;
+   }
+   ret[n] = '\0';
+}
+
+void dict_mapped_close(dict_mapped** m)
+{
+   if (!m || !*m) {
+      return;
+   }
+   munmap((void*)(*m)->map, (*m)->size);
+   free(*m);
+   *m = NULL;
+}
+
+/* Double-array trie: the state reached from state s on letter
+   slot i is t = cell[s].base + i + 1, which is valid only if
+   cell[t].check == s. Each step is then one read of a pair of
+   ints from a single flat array. State 0 is the top. */
+typedef struct da_cell {
+   int32_t base;
+   int32_t check; // Parent state, or -1 if the cell is free
+} da_cell;
+
+struct dict_da {
+   da_cell* cell;
+   int32_t* freq;  // Times the word ending at each state was added
+   int size;       // Cells in use, up to the last taken one
+   int states;
+};
+
+/* While building, the free cells are also chained in order
+   (both ways, so any can be unlinked), letting the search for
+   a base skip straight over taken cells. */
+typedef struct da_build {
+   dict_da* a;
+   int cap;    // Cells allocated
+   int* next;  // Next free cell after each free cell, or -1
+   int* prev;  // Previous free cell, or -1
+   int head;   // First free cell, or -1
+   int last;   // Last free cell, or -1
+} da_build;
+
+// Makes sure cells [0, need) exist, new ones free and chained
+static void da_grow(da_build* b, int need)
+{
+   if (need <= b->cap) {
+      return;
+   }
+   dict_da* a = b->a;
+   int n = b->cap ? b->cap : need;
+   while (n < need) {
+      n *= 2;
+   }
+   a->cell = (da_cell*)realloc(a->cell, (size_t)n * sizeof(da_cell));
+   a->freq = (int32_t*)realloc(a->freq, (size_t)n * sizeof(int32_t));
+   b->next = (int*)realloc(b->next, (size_t)n * sizeof(int));
+   b->prev = (int*)realloc(b->prev, (size_t)n * sizeof(int));
+   if (!a->cell || !a->freq || !b->next || !b->prev) {
+      fprintf(stderr, "Memory allocation failed in dict_da_build\n");
+      exit(EXIT_FAILURE);
+   }
+   for (int i = b->cap; i < n; i++) {
+      a->cell[i].base = 0;
+      a->cell[i].check = -1;
+      a->freq[i] = 0;
+      b->prev[i] = b->last;
+      b->next[i] = -1;
+      if (b->last >= 0) {
+         b->next[b->last] = i;
+      } else {
+         b->head = i;
+      }
+      b->last = i;
+   }
+   b->cap = n;
+}
+
+// Marks cell t as taken by a child of state s
+static void da_take(da_build* b, int t, int s)
+{
+   b->a->cell[t].check = s;
+   if (b->prev[t] >= 0) {
+      b->next[b->prev[t]] = b->next[t];
+   } else {
+      b->head = b->next[t];
+   }
+   if (b->next[t] >= 0) {
+      b->prev[b->next[t]] = b->prev[t];
+   } else {
+      b->last = b->prev[t];
+   }
+   if (t + 1 > b->a->size) {
+      b->a->size = t + 1;
+   }
+}
+
+dict_da* dict_da_build(const dict* p)
+{
+   if (!p) {
+      return NULL;
+   }
+   dict_da* a = (dict_da*)calloc(1, sizeof(dict_da));
+   int n = dict_nodecount(p);
+   const dict** node = (const dict**)malloc((size_t)n * sizeof(dict*));
+   int* state = (int*)malloc((size_t)n * sizeof(int));
+   if (!a || !node || !state) {
+      fprintf(stderr, "Memory allocation failed in dict_da_build\n");
+      exit(EXIT_FAILURE);
+   }
+   da_build b = {a, 0, NULL, NULL, -1, -1};
+   da_grow(&b, n + 2 * (ALPHA + 1));
+   da_take(&b, 0, 0);
+
+   /* Place the nodes breadth first. For each, take the lowest base
+      at which all its children's cells are free, trying only bases
+      that put its first child on a free cell. */
+   int tail = 0;
+   node[tail] = p;
+   state[tail++] = 0;
+   for (int q = 0; q < tail; q++) {
+      const dict* d = node[q];
+      int s = state[q];
+      a->freq[s] = d->terminal ? d->freq : 0;
+      if (!d->dwn) {
+         continue;
+      }
+      uint32_t mask = d->dwn->mask;
+      int low = 0;
+      while (!((mask >> low) & 1u)) {
+         low++;
+      }
+      int base = 0;
+      for (int pos = b.head;; pos = b.next[pos]) {
+         if (pos < 0) {
+            // Out of free cells: the new ones follow the last taken
+            pos = b.cap;
+            da_grow(&b, b.cap + ALPHA + 1);
+         }
+         base = pos - low - 1;
+         if (base < 1) {
+            continue;
+         }
+         da_grow(&b, base + ALPHA + 1);
+         bool fits = true;
+         for (int i = low + 1; i < ALPHA && fits; i++) {
+            fits = !((mask >> i) & 1u) || a->cell[base + i + 1].check < 0;
+         }
+         if (fits) {
+            break;
+         }
+      }
+      a->cell[s].base = base;
+      for (int i = 0, j = 0; i < ALPHA; i++) {
+         if ((mask >> i) & 1u) {
+            int t = base + i + 1;
+            da_take(&b, t, s);
+            node[tail] = d->dwn->kid[j++];
+            state[tail++] = t;
+         }
+      }
+   }
+   a->states = tail;
+   free(node);
+   free(state);
+   free(b.next);
+   free(b.prev);
+
+   // Trim to the cells in use, keeping room for any step off the end
+   int keep = a->size + ALPHA + 1;
+   if (keep < b.cap) {
+      a->cell = (da_cell*)realloc(a->cell, (size_t)keep * sizeof(da_cell));
+      a->freq = (int32_t*)realloc(a->freq, (size_t)keep * sizeof(int32_t));
+   }
+   return a;
+}
+
+int dict_da_freq(const dict_da* a, const char* wd)
+{
+   if (!a || !wd || !*wd) {
+      return 0;
+   }
+   int s = 0;
+   for (; *wd; wd++) {
+      int index = word_slot(*wd);
+      if (index < 0) {
+         return 0;
+      }
+      int t = a->cell[s].base + index + 1;
+      if (a->cell[t].check != s) {
+         return 0;
+      }
+      s = t;
+   }
+   return a->freq[s];
+}
+
+bool dict_da_spell(const dict_da* a, const char* wd)
+{
+   return dict_da_freq(a, wd) > 0;
+}
+
+int dict_da_nodecount(const dict_da* a)
+{
+   return a ? a->states : 0;
+}
+
+// Bytes held by a, to compare with the tree it was built from
+size_t dict_da_bytes(const dict_da* a)
+{
+   if (!a) {
+      return 0;
+   }
+   return sizeof(dict_da) + (size_t)(a->size + ALPHA + 1) * (sizeof(da_cell) + sizeof(int32_t));
+}
+
+void dict_da_free(dict_da** a)
+{
+   if (!a || !*a) {
+      return;
+   }
+   free((*a)->cell);
+   free((*a)->freq);
+   free(*a);
+   *a = NULL;
+}
+
+// Letter slot under which node c hangs from its parent
+static int slot_of(const dict* c)
+{
+   const dict_kids* k = c->up->dwn;
+   int j = 0;
+   for (int i = 0; i < ALPHA; i++) {
+      if ((k->mask >> i) & 1u) {
+         if (k->kid[j++] == c) {
+            return i;
+         }
+      }
+   }
+   return -1;
+}
+
+// True if terminal a ranks ahead of terminal b: freq, then alphabetical
+static bool ranks_before(const dict* a, const dict* b)
+{
+   if (a->freq != b->freq) {
+      return a->freq > b->freq;
+   }
+   int da = 0, db = 0;
+   for (const dict* t = a; t->up; t = t->up) {
+      da++;
+   }
+   for (const dict* t = b; t->up; t = t->up) {
+      db++;
+   }
+   // A word comes before any longer word it is a prefix of
+   const dict* x = a;
+   const dict* y = b;
+   for (int d = da; d > db; d--) {
+      x = x->up;
+   }
+   for (int d = db; d > da; d--) {
+      y = y->up;
+   }
+   if (x == y) {
+      return da < db;
+   }
+   // Otherwise by the letters where the two paths split
+   while (x->up != y->up) {
+      x = x->up;
+      y = y->up;
+   }
+   return slot_of(x) < slot_of(y);
+}
+
+// Entries of the dict_autocomplete_topk frontier
+#define TOPK_STACK 16
+typedef struct topk_entry {
+   const dict* node; // Subtree (or single word) still to be ranked
+   const dict* key;  // Best word it can offer
+   bool whole;       // Whole subtree of 'node', or just 'node' itself
+} topk_entry;
+
+/* Adds a candidate to the frontier, which is kept sorted best first
+   and never holds more than 'room' entries: anything ranked below
+   that many others can never make the top k. */
+static void topk_push(topk_entry* f, int* n, int room, const dict* node, const dict* key, bool whole)
+{
+   if (!key || room <= 0) {
+      return;
+   }
+   int at = *n;
+   while (at > 0 && ranks_before(key, f[at - 1].key)) {
+      at--;
+   }
+   if (at >= room) {
+      return;
+   }
+   int last = (*n < room) ? *n : room - 1;
+   memmove(&f[at + 1], &f[at], (size_t)(last - at) * sizeof(topk_entry));
+   f[at].node = node;
+   f[at].key = key;
+   f[at].whole = whole;
+   if (*n < room) {
+      (*n)++;
+   }
+}
+
+// Pushes every child subtree of p, except 'skip'
+static void topk_push_kids(topk_entry* f, int* n, int room, const dict* p, const dict* skip)
+{
+   if (p->dwn) {
+      for (int i = 0; i < POPCOUNT(p->dwn->mask); i++) {
+         const dict* c = p->dwn->kid[i];
+         if (c != skip) {
+            topk_push(f, n, room, c, c->best, true);
+         }
+      }
+   }
+}
+
+// Writes the letters from 'from' down to 'to' into ret
+static void write_suffix(const dict* from, const dict* to, char* ret)
+{
+   int n = 0;
+   for (const dict* c = to; c != from; c = c->up) {
+      int i = slot_of(c);
+      ret[n++] = (i == ALPHA - 1) ? '\'' : 'a' + i;
+   }
+   ret[n] = '\0';
+   for (int i = 0; i < n / 2; i++) {
+      char t = ret[i];
+      ret[i] = ret[n - 1 - i];
+      ret[n - 1 - i] = t;
+   }
+}
+
+int dict_autocomplete_topk(const dict* p, const char* wd, int k, char* ret[])
+{
+   if (!p || !wd || !ret || k <= 0) {
+      return 0;
+   }
+
+   const dict* prefix = p;
+
+   // Traverse the prefix
+   while (*wd) {
+      int index = word_slot(*wd);
+      if (index < 0 || !(prefix = dict_child(prefix, index))) {
+         return 0; // Prefix not found
+      }
+      wd++;
+   }
+
+   // Only one allocation per call, and none for small k
+   topk_entry local[TOPK_STACK];
+   topk_entry* f = local;
+   if (k > TOPK_STACK) {
+      f = (topk_entry*)malloc((size_t)k * sizeof(topk_entry));
+      if (!f) {
+         fprintf(stderr, "Memory allocation failed in dict_autocomplete_topk\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   /* Best-first: the front entry's key beats everything else left,
+      so it is the next result. What remains of its subtree is split
+      into the words on the path down to the key and the subtrees
+      hanging off that path, each entered under its cached best. */
+   int n = 0;
+   int found = 0;
+   topk_push_kids(f, &n, k, prefix, NULL);
+   while (n > 0 && found < k) {
+      topk_entry e = f[0];
+      memmove(&f[0], &f[1], (size_t)(n - 1) * sizeof(topk_entry));
+      n--;
+      write_suffix(prefix, e.key, ret[found++]);
+      int room = k - found;
+      if (e.whole) {
+         topk_push_kids(f, &n, room, e.key, NULL);
+         for (const dict* c = e.key; c != e.node; c = c->up) {
+            const dict* x = c->up;
+            if (x->terminal) {
+               topk_push(f, &n, room, x, x, false);
+            }
+            topk_push_kids(f, &n, room, x, c);
+         }
+      }
+   }
+
+   if (f != local) {
+      free(f);
+   }
+   return found;
+}
+
+int dict_topn(const dict* p, int n, char* out_words[], int out_freqs[])
+{
+   if (!p || n <= 0) {
+      return 0;
+   }
+   // The order is kept sorted as words are added: just read it off
+   const dict_hdr* h = dict_header(p);
+   if (n > h->ordered) {
+      n = h->ordered;
+   }
+   for (int i = 0; i < n; i++) {
+      const dict* t = h->order[i];
+      if (out_words) {
+         write_suffix(&h->root, t, out_words[i]);
+      }
+      if (out_freqs) {
+         out_freqs[i] = t->freq;
+      }
    }
+   return n;
+}
 
-   // Mark the node as the end of a word
-   current->terminal = true;
-   current->freq = 1; // Initialize frequency
+/* dict_suggest walks the tree carrying one row of the edit distance
+   table per depth: row d holds the distance from the first j letters
+   of the word to the d letters of the path so far, for every j. A
+   child's row is made from its parent's, and a subtree is skipped as
+   soon as every entry of its row is over the limit, since no word
+   below can come back under it. Entries are capped at limit + 1 so
+   they fit a byte. */
+typedef struct suggest_entry {
+   const dict* node;
+   int dist;
+} suggest_entry;
 
-   return true; // Successfully added a new word
-}
+typedef struct suggest_job {
+   const unsigned char* slot; // The word, as slots
+   int m;                     // Its length
+   int limit;                 // Largest distance still wanted
+   uint8_t* rows;             // Row for depth d at rows[d * (m + 1)]
+   int depth;                 // Deepest row there is room for
+   suggest_entry* best;       // Best first: distance, then freq
+   int n;
+   int k;
+} suggest_job;
 
-void dict_free(dict** d)
+// Keeps word t, 'dist' edits away, if it is among the k best so far
+static void suggest_push(suggest_job* s, const dict* t, int dist)
 {
-   // Check if the pointer to the dictionary or its content is NULL.
-   if (d == NULL) {
-      return;
+   int at = s->n;
+   // Found in alphabetical order, so on a full tie the earlier stays ahead
+   while (at > 0 && (dist < s->best[at - 1].dist ||
+                     (dist == s->best[at - 1].dist && t->freq > s->best[at - 1].node->freq))) {
+      at--;
    }
-   if (*d == NULL) {
+   if (at >= s->k) {
       return;
    }
-
-   dict* current = *d;
-
-   // Recursively free all child nodes.
-   for (int i = 0; i < ALPHA; i++) {
-      dict_free(&current->dwn[i]);
+   int last = (s->n < s->k) ? s->n : s->k - 1;
+   memmove(&s->best[at + 1], &s->best[at], (size_t)(last - at) * sizeof(suggest_entry));
+   s->best[at].node = t;
+   s->best[at].dist = dist;
+   if (s->n < s->k) {
+      s->n++;
+   }
+   // Once k are found, nothing further away than the last can get in
+   if (s->n == s->k && s->best[s->k - 1].dist < s->limit) {
+      s->limit = s->best[s->k - 1].dist;
    }
-
-   // Free the current node.
-   free(current);
-
-   // Set the dictionary pointer to NULL to avoid dangling pointers.
-   *d = NULL;
 }
 
-int dict_wordcount(const dict* p)
+static void suggest_walk(suggest_job* s, const dict* p, int d)
 {
-   // Base case: If the node is NULL, it does not contribute to the count.
-   if (p == NULL) {
-      return 0;
+   // Locals, as byte stores could otherwise be any of these
+   const int m = s->m;
+   const unsigned char* slot = s->slot;
+   const uint8_t* row = s->rows + (size_t)d * (m + 1);
+   int gap = m > d ? m - d : d - m;
+   if (p->terminal && gap <= s->limit && row[m] <= s->limit) {
+      suggest_push(s, p, row[m]);
    }
-
-   // Initialize the count with the frequency of this node, if it is terminal.
-   int count = 0;
-   if (p->terminal) {
-      count = p->freq;
+   const dict_kids* k = p->dwn;
+   if (!k || d == s->depth) {
+      return;
    }
-
-   // Recursively add the word counts of all child nodes.
-   for (int i = 0; i < ALPHA; i++) {
-      count += dict_wordcount(p->dwn[i]);
+   uint8_t* next = (uint8_t*)row + m + 1;
+   uint32_t mask = k->mask;
+   for (int i = 0, j = 0; mask; i++, mask >>= 1) {
+      if (!(mask & 1u)) {
+         continue;
+      }
+      const dict* c = k->kid[j++];
+      /* Entry x is at least |x - (d + 1)|, so only the band of x
+         within 'limit' of the depth is worked out; the entries
+         either side of it are marked over the limit. */
+      int limit = s->limit;
+      int cap = limit + 1;
+      int lo = d + 1 - limit > 1 ? d + 1 - limit : 1;
+      int hi = d + 1 + limit < m ? d + 1 + limit : m;
+      int left = d + 1 < cap ? d + 1 : cap;
+      next[0] = (uint8_t)left;
+      if (lo > 1) {
+         left = cap;
+         next[lo - 1] = (uint8_t)cap;
+      }
+      if (hi < m) {
+         next[hi + 1] = (uint8_t)cap;
+      }
+      int least = left;
+      for (int x = lo; x <= hi; x++) {
+         int v = row[x - 1] + (slot[x - 1] != i); // Keep or change a letter
+         if (row[x] + 1 < v) {
+            v = row[x] + 1;                       // Add one
+         }
+         if (left + 1 < v) {
+            v = left + 1;                         // Drop one
+         }
+         left = v < cap ? v : cap;
+         next[x] = (uint8_t)left;
+         if (left < least) {
+            least = left;
+         }
+      }
+      if (least <= limit) {
+         suggest_walk(s, c, d + 1);
+      }
    }
-
-   // Return the total word count for this node and its children.
-   return count;
 }
 
-
-int dict_nodecount(const dict* p)
+int dict_suggest(const dict* p, const char* wd, int max_dist, int k, char* out[])
 {
-   // Base case: If the node is NULL, it does not contribute to the count.
-   if (p == NULL) {
+   unsigned char slot[WORD_MAXLEN + 1];
+   if (!p || !wd || !out || k <= 0 || max_dist < 0 || !norm_word(wd, strlen(wd), NULL, slot)) {
       return 0;
    }
-
-   // Initialize the count for the current node.
-   int count = 1;
-
-   // Recursively add the counts of all child nodes.
-   for (int i = 0; i < ALPHA; i++) {
-      count += dict_nodecount(p->dwn[i]);
+   suggest_job s;
+   s.slot = slot;
+   s.m = (int)strlen(wd);
+   s.limit = max_dist < WORD_MAXLEN ? max_dist : WORD_MAXLEN;
+   // A word more than 'limit' letters longer is too far anyway
+   s.depth = s.m + s.limit < WORD_MAXLEN ? s.m + s.limit : WORD_MAXLEN;
+   s.n = 0;
+   s.k = k;
+   s.rows = (uint8_t*)malloc((size_t)(s.depth + 1) * (s.m + 1));
+   s.best = (suggest_entry*)malloc((size_t)k * sizeof(suggest_entry));
+   if (!s.rows || !s.best) {
+      fprintf(stderr, "Memory allocation failed in dict_suggest\n");
+      exit(EXIT_FAILURE);
    }
+   // Row 0: the empty path is j edits from the first j letters
+   for (int x = 0; x <= s.m; x++) {
+      s.rows[x] = (uint8_t)(x <= s.limit ? x : s.limit + 1);
+   }
+   suggest_walk(&s, p, 0);
 
-   // Return the total node count for this node and its children.
-   return count;
+   for (int i = 0; i < s.n; i++) {
+      write_suffix(p, s.best[i].node, out[i]);
+   }
+   free(s.rows);
+   free(s.best);
+   return s.n;
 }
 
+/* dict_match: the pattern and clues are first turned into the
+   letters allowed at each position (a bitmask of slots, as in a
+   child block's mask) and the letters the word must contain. */
+#define MATCH_ALL ((1u << ALPHA) - 1)
 
-/**
- * Checks if a word exists in the dictionary tree.
- * Returns the terminal node if the word exists, NULL otherwise.
- */
-dict* dict_spell(const dict* p, const char* str)
+typedef struct match_rule {
+   int len;
+   uint32_t allowed[WORD_MAXLEN];
+   uint32_t need;
+} match_rule;
+
+// Bitmask of the slots of the letters in str; false if one isn't a letter or '
+static bool match_letters(const char* str, uint32_t* mask)
 {
-   // Return NULL if the input dictionary or string is invalid
-   if (!p || !str || !*str) {
-      return NULL;
+   *mask = 0;
+   for (; str && *str; str++) {
+      int s = word_slot(*str);
+      if (s < 0) {
+         return false;
+      }
+      *mask |= 1u << s;
    }
+   return true;
+}
 
-   const dict* current = p;
-
-   // Traverse the tree character by character
-   while (*str) {
-      // Calculate the index for the current character
-      int index = (*str == '\'') ? 26 : tolower(*str) - 'a';
-
-      // If the index is out of bounds or the child node doesn't exist, return NULL
-      if (index < 0 || index >= ALPHA || !current->dwn[index]) {
-         return NULL;
+static bool match_compile(const char* pattern, const dict_clues* clues, match_rule* r)
+{
+   size_t len = pattern ? strlen(pattern) : 0;
+   if (len == 0 || len > WORD_MAXLEN) {
+      return false;
+   }
+   uint32_t absent = 0;
+   r->need = 0;
+   if (clues && (!match_letters(clues->absent, &absent) || !match_letters(clues->present, &r->need))) {
+      return false;
+   }
+   r->len = (int)len;
+   for (size_t i = 0; i < len; i++) {
+      if (pattern[i] == '?' || pattern[i] == '.') {
+         r->allowed[i] = MATCH_ALL;
+      } else {
+         int s = word_slot(pattern[i]);
+         if (s < 0) {
+            return false;
+         }
+         r->allowed[i] = 1u << s;
       }
-
-      // Move to the next node
-      current = current->dwn[index];
-      str++;
    }
-
-   // Return the node if it is a terminal node, otherwise NULL
-   return current->terminal ? (dict*)current : NULL;
+   for (size_t i = 0; i < len; i++) {
+      uint32_t no = 0;
+      if (clues && clues->not_at && !match_letters(clues->not_at[i], &no)) {
+         return false;
+      }
+      /* Absent letters are kept where the pattern fixes them, and
+         wherever they are also needed: Wordle greys the copies
+         of a letter beyond the ones in the word. */
+      if (r->allowed[i] == MATCH_ALL) {
+         r->allowed[i] &= ~(absent & ~r->need);
+      }
+      r->allowed[i] &= ~no;
+   }
+   return true;
 }
 
-
-int dict_mostcommon(const dict* p)
+static int match_walk(const dict* p, const match_rule* r, int d, uint32_t seen, char* buf,
+                      void (*cb)(const char* wd, int freq, void* arg), void* arg)
 {
-   // Base case: If the node is NULL, it cannot have a frequency.
-   if (!p) {
+   if (d == r->len) {
+      if (!p->terminal || (r->need & ~seen)) {
+         return 0;
+      }
+      buf[d] = '\0';
+      cb(buf, p->freq, arg);
+      return 1;
+   }
+   // Too few letters left for the ones still needed
+   if (POPCOUNT(r->need & ~seen) > r->len - d || !p->dwn) {
       return 0;
    }
-
-   // Start with the frequency of this node if it is terminal.
-   int max_freq = p->terminal ? p->freq : 0;
-
-   // Recursively find the maximum frequency in child nodes.
-   for (int i = 0; i < ALPHA; i++) {
-      int child_freq = dict_mostcommon(p->dwn[i]);
-      if (child_freq > max_freq) {
-         max_freq = child_freq;
+   int n = 0;
+   uint32_t mask = p->dwn->mask;
+   uint32_t take = mask & r->allowed[d];
+   for (int i = 0; take >> i; i++) {
+      if ((take >> i) & 1u) {
+         buf[d] = (i == ALPHA - 1) ? '\'' : 'a' + i;
+         const dict* c = p->dwn->kid[POPCOUNT(mask & ((1u << i) - 1))];
+         n += match_walk(c, r, d + 1, seen | (1u << i), buf, cb, arg);
       }
    }
-
-   // Return the maximum frequency found.
-   return max_freq;
+   return n;
 }
 
-
-// CHALLENGE1
-unsigned dict_cmp(dict* p1, dict* p2)
+int dict_match(const dict* p, const char* pattern, const dict_clues* clues,
+               void (*cb)(const char* wd, int freq, void* arg), void* arg)
 {
-   if (!p1 || !p2) {
-      return 0; // If either node is NULL, return 0
+   match_rule r;
+   if (!p || !cb || !match_compile(pattern, clues, &r)) {
+      return 0;
    }
+   char buf[WORD_MAXLEN + 1];
+   return match_walk(p, &r, 0, 0, buf, cb, arg);
+}
 
-   int depth1 = 0, depth2 = 0;
-   dict* temp;
+/* The frozen index behind dict_match_indexed: its words, in order,
+   and a bitset over them for each letter at each position, and for
+   each letter anywhere. A rule is then a few ANDs of whole bitsets. */
+struct dict_match_index {
+   int len;            // Length of every word
+   int n;              // Words
+   int blocks;         // 64-bit words per bitset
+   char* word;         // Word i at word[i * (len + 1)]
+   int* freq;
+   uint64_t* at;       // Bitset of letter c at position i: at + (i * ALPHA + c) * blocks
+   uint64_t* has;      // Bitset of letter c anywhere: has + c * blocks
+};
 
-   // Calculate the depth of p1
-   for (temp = p1; temp; temp = temp->up) {
-      depth1++;
+// Lists the words of length x->len below p (which is d letters in) into x
+static void match_collect(dict_match_index* x, const dict* p, int d, char* buf, int* cap)
+{
+   if (d == x->len) {
+      if (p->terminal) {
+         if (x->n == *cap) {
+            *cap = *cap ? *cap * 2 : 256;
+            x->word = (char*)realloc(x->word, (size_t)*cap * (x->len + 1));
+            x->freq = (int*)realloc(x->freq, (size_t)*cap * sizeof(int));
+            if (!x->word || !x->freq) {
+               fprintf(stderr, "Memory allocation failed in dict_match_build\n");
+               exit(EXIT_FAILURE);
+            }
+         }
+         memcpy(x->word + (size_t)x->n * (x->len + 1), buf, (size_t)x->len + 1);
+         x->freq[x->n++] = p->freq;
+      }
+      return;
    }
-
-   // Calculate the depth of p2
-   for (temp = p2; temp; temp = temp->up) {
-      depth2++;
+   if (p->dwn) {
+      int j = 0;
+      for (int i = 0; i < ALPHA; i++) {
+         if ((p->dwn->mask >> i) & 1u) {
+            buf[d] = (i == ALPHA - 1) ? '\'' : 'a' + i;
+            match_collect(x, p->dwn->kid[j++], d + 1, buf, cap);
+         }
+      }
    }
+}
 
-   // Calculate the total distance
-   unsigned total_distance = 0;
-
-   // Bring both nodes to the same depth
-   while (depth1 > depth2) {
-      p1 = p1->up;
-      depth1--;
-      total_distance++;
+dict_match_index* dict_match_build(const dict* p, int len)
+{
+   if (!p || len <= 0 || len > WORD_MAXLEN) {
+      return NULL;
    }
-   while (depth2 > depth1) {
-      p2 = p2->up;
-      depth2--;
-      total_distance++;
+   dict_match_index* x = (dict_match_index*)calloc(1, sizeof(dict_match_index));
+   if (!x) {
+      fprintf(stderr, "Memory allocation failed in dict_match_build\n");
+      exit(EXIT_FAILURE);
    }
+   x->len = len;
+   char buf[WORD_MAXLEN + 1];
+   buf[len] = '\0';
+   int cap = 0;
+   match_collect(x, p, 0, buf, &cap);
 
-   // Move both nodes up until they meet at a common ancestor
-   while (p1 != p2) {
-      p1 = p1->up;
-      p2 = p2->up;
-      total_distance += 2; // Increment for each step up
+   x->blocks = (x->n + 63) / 64;
+   size_t bits = (size_t)x->blocks * ALPHA;
+   x->at = (uint64_t*)calloc(bits * (size_t)(len + 1), sizeof(uint64_t));
+   if (!x->at) {
+      fprintf(stderr, "Memory allocation failed in dict_match_build\n");
+      exit(EXIT_FAILURE);
    }
-
-   return total_distance;
+   x->has = x->at + bits * (size_t)len;
+   for (int w = 0; w < x->n; w++) {
+      const char* wd = x->word + (size_t)w * (len + 1);
+      uint64_t bit = 1ull << (w % 64);
+      for (int i = 0; i < len; i++) {
+         int c = word_slot(wd[i]);
+         x->at[((size_t)i * ALPHA + c) * x->blocks + w / 64] |= bit;
+         x->has[(size_t)c * x->blocks + w / 64] |= bit;
+      }
+   }
+   return x;
 }
 
-// CHALLENGE2
-// Static helper function declaration
-static void dict_autocomplete_helper(const dict* p, char* buffer, int depth, char* best_word, int* max_freq);
-
-void dict_autocomplete(const dict* p, const char* wd, char* ret)
+int dict_match_indexed(const dict_match_index* x, const char* pattern, const dict_clues* clues,
+                       void (*cb)(const char* wd, int freq, void* arg), void* arg)
 {
-   if (!p || !wd) {
-      *ret = '\0'; // Invalid input, return empty string
-      return;
+   match_rule r;
+   if (!x || !cb || !match_compile(pattern, clues, &r) || r.len != x->len) {
+      return 0;
+   }
+   uint64_t* hit = (uint64_t*)malloc(((size_t)x->blocks + 1) * sizeof(uint64_t));
+   if (!hit) {
+      fprintf(stderr, "Memory allocation failed in dict_match_indexed\n");
+      exit(EXIT_FAILURE);
+   }
+   for (int b = 0; b < x->blocks; b++) {
+      hit[b] = ~0ull;
+   }
+   if (x->n % 64) {
+      hit[x->blocks - 1] = (1ull << (x->n % 64)) - 1;
    }
 
-   const dict* current = p;
+   /* At each position: AND in the one letter allowed, or take out
+      the letters that aren't; both are whole bitsets. */
+   for (int i = 0; i < r.len; i++) {
+      uint32_t allowed = r.allowed[i];
+      const uint64_t* at = x->at + (size_t)i * ALPHA * x->blocks;
+      if (POPCOUNT(allowed) == 1) {
+         int c = CTZ(allowed);
+         for (int b = 0; b < x->blocks; b++) {
+            hit[b] &= at[(size_t)c * x->blocks + b];
+         }
+         continue;
+      }
+      for (int c = 0; c < ALPHA; c++) {
+         if (!((allowed >> c) & 1u)) {
+            for (int b = 0; b < x->blocks; b++) {
+               hit[b] &= ~at[(size_t)c * x->blocks + b];
+            }
+         }
+      }
+   }
+   for (int c = 0; c < ALPHA; c++) {
+      if ((r.need >> c) & 1u) {
+         for (int b = 0; b < x->blocks; b++) {
+            hit[b] &= x->has[(size_t)c * x->blocks + b];
+         }
+      }
+   }
 
-   // Traverse the prefix
-   while (*wd) {
-      int index = (*wd == '\'') ? ALPHA - 1 : tolower(*wd) - 'a';
-      if (index < 0 || index >= ALPHA || !current->dwn[index]) {
-         *ret = '\0'; // Prefix not found
-         return;
+   int n = 0;
+   for (int b = 0; b < x->blocks; b++) {
+      for (uint64_t m = hit[b]; m; m &= m - 1) {
+         int w = b * 64 + CTZ(m);
+         cb(x->word + (size_t)w * (x->len + 1), x->freq[w], arg);
+         n++;
       }
-      current = current->dwn[index];
-      wd++;
    }
+   free(hit);
+   return n;
+}
 
-   // Buffer for constructing the word and tracking max frequency
-   char buffer[BUFFER_SIZE] = {0}; // Use defined BUFFER_SIZE
-   strcpy(buffer, wd);             // Start buffer with prefix
-   int depth = strlen(wd);         // Set initial depth as prefix length
-   int max_freq = 0;
+void dict_match_free(dict_match_index** x)
+{
+   if (!x || !*x) {
+      return;
+   }
+   free((*x)->word);
+   free((*x)->freq);
+   free((*x)->at);
+   free(*x);
+   *x = NULL;
+}
 
-   // Initialize best_word to empty
-   char best_word[BUFFER_SIZE] = {0};
+/* A cursor is a depth-first walk with its stack kept in the cursor
+   rather than on the call stack, so it can stop after any word and
+   carry on later. No word ends more than WORD_MAXLEN letters below
+   the top node (the adds refuse one that would), so the stack and
+   the word being built have a fixed size. */
+typedef struct cursor_frame {
+   const dict* node;
+   uint32_t left;      // Slots of the children not visited yet
+   int at;             // Index in node->dwn of the next of them
+   bool told;          // Node itself already given (or not a word)
+} cursor_frame;
 
-   // Recursive search for the most frequent word
-   dict_autocomplete_helper(current, buffer, depth, best_word, &max_freq);
+struct dict_cursor {
+   int top;            // Frame of the node the walk is at, -1 when done
+   int base;           // Letters of the prefix
+   cursor_frame stack[WORD_MAXLEN + 1];
+   char key[WORD_MAXLEN + 1];
+};
 
-   // Extract the additional letters required
-   if (strlen(best_word) > depth) {
-      strcpy(ret, &best_word[depth]);
-   } else {
-      *ret = '\0'; // No additional letters
+dict_cursor* dict_cursor_open(const dict* p, const char* prefix)
+{
+   if (!p || !prefix) {
+      return NULL;
+   }
+   dict_cursor* c = (dict_cursor*)malloc(sizeof(dict_cursor));
+   if (!c) {
+      fprintf(stderr, "Memory allocation failed in dict_cursor_open\n");
+      exit(EXIT_FAILURE);
+   }
+   c->top = -1; // Nothing to list unless the prefix is there
+   size_t len = strlen(prefix);
+   if (len == 0 || norm_word(prefix, len, c->key, NULL)) {
+      for (size_t i = 0; i < len && p; i++) {
+         p = dict_child(p, word_slot(prefix[i]));
+      }
+      if (p) {
+         c->top = 0;
+         c->base = (int)len;
+         c->stack[0].node = p;
+         c->stack[0].left = p->dwn ? p->dwn->mask : 0;
+         c->stack[0].at = 0;
+         c->stack[0].told = false;
+      }
    }
+   return c;
 }
 
-static void dict_autocomplete_helper(const dict* p, char* buffer, int depth, char* best_word, int* max_freq)
+bool dict_cursor_next(dict_cursor* c, const char** wd, int* freq)
 {
-   if (!p) {
-      return;
+   if (!c) {
+      return false;
    }
-
-   // Recursively explore child nodes (skip the current node itself)
-   for (int i = 0; i < ALPHA; i++) {
-      if (p->dwn[i]) {
-         buffer[depth] = (i == ALPHA - 1) ? '\'' : 'a' + i; // Append the current character
-         dict_autocomplete_helper(p->dwn[i], buffer, depth + 1, best_word, max_freq);
+   while (c->top >= 0) {
+      cursor_frame* f = &c->stack[c->top];
+      int len = c->base + c->top;
+      // A node is a word before anything below it
+      if (!f->told) {
+         f->told = true;
+         if (f->node->terminal) {
+            c->key[len] = '\0';
+            if (wd) {
+               *wd = c->key;
+            }
+            if (freq) {
+               *freq = f->node->freq;
+            }
+            return true;
+         }
       }
+      if (!f->left) {
+         c->top--;
+         continue;
+      }
+      int i = CTZ(f->left);
+      f->left &= f->left - 1;
+      const dict* n = f->node->dwn->kid[f->at++];
+      c->key[len] = (i == ALPHA - 1) ? '\'' : 'a' + i;
+      cursor_frame* g = &c->stack[++c->top];
+      g->node = n;
+      g->left = n->dwn ? n->dwn->mask : 0;
+      g->at = 0;
+      g->told = false;
    }
+   return false;
+}
 
-   // Check if the current node terminates a word and is a valid candidate
-   if (p->terminal && depth > 0 && p->freq > *max_freq) {
-      buffer[depth] = '\0'; // Null-terminate the buffer
-      strcpy(best_word, buffer); // Update best_word
-      *max_freq = p->freq;       // Update max frequency
+void dict_cursor_close(dict_cursor** c)
+{
+   if (!c) {
+      return;
    }
+   free(*c);
+   *c = NULL;
 }
 
 
+// Test helper for dict_frozen_prefix: appends each word to a string
+static void test_listword(const char* wd, int freq, void* arg)
+{
+   char* out = (char*)arg;
+   sprintf(out + strlen(out), "%s:%d ", wd, freq);
+}
+
+static void test_countword(const char* wd, int freq, void* arg)
+{
+   (void)wd;
+   (void)freq;
+   (*(int*)arg)++;
+}
+
+// One thread of the dict_writer test: adds all the words, starting from 'from'
+typedef struct writer_test {
+   dict* d;
+   char (*words)[4];
+   int n;
+   int from;
+} writer_test;
+
+static void* writer_test_run(void* arg)
+{
+   writer_test* t = (writer_test*)arg;
+   dict_writer* w = dict_writer_new(t->d);
+   for (int i = 0; i < t->n; i++) {
+      dict_writer_add(w, t->words[(t->from + i) % t->n]);
+   }
+   dict_writer_free(&w);
+   return NULL;
+}
 
+// A reader of the dict_versioned test: every version it pins is whole
+typedef struct vers_test {
+   dict_versioned* v;
+   int done;           // Set once the writer has finished (atomic)
+   int seen;           // Versions pinned
+} vers_test;
+
+static void* vers_test_run(void* arg)
+{
+   vers_test* t = (vers_test*)arg;
+   char ret[WORD_MAXLEN + 1];
+   int words = 0;
+   while (!ATOMIC_LOAD(&t->done)) {
+      int ticket;
+      const dict* s = dict_versioned_pin(t->v, &ticket);
+      int n = dict_wordcount(s);
+      assert(n >= words && dict_spell(s, "baa"));
+      dict_autocomplete(s, "b", ret);
+      assert(strcmp(ret, "aa") == 0);
+      assert(dict_wordcount(s) == n);
+      words = n;
+      dict_versioned_unpin(t->v, ticket);
+      t->seen++;
+   }
+   return NULL;
+}
 
 void test(void)
 {
@@ -350,11 +3537,18 @@ void test(void)
    int most_common_freq = dict_mostcommon(my_dict);
    assert(most_common_freq == 2); // "car" was added twice
 
+   // Below the top node the counts recurse, and agree with the totals
+   found = dict_spell(my_dict, "car");
+   assert(dict_nodecount(found) == 2);
+   assert(dict_wordcount(found) == 3);
+   assert(dict_mostcommon(found) == 2);
+   assert(dict_wordcount(dict_spell(my_dict, "part")) == 1);
+
    // Test dict_cmp
    dict* node1 = dict_spell(my_dict, "car");
    dict* node2 = dict_spell(my_dict, "part");
    assert(node1 != NULL && node2 != NULL);
-   unsigned distance = dict_cmp(node1, node2);
+   assert(dict_cmp(node1, node2) == 7); // Up 1 to "par", then 3 each to the top
 
    // Test autocomplete
    char result[256];
@@ -365,7 +3559,540 @@ void test(void)
    dict_autocomplete(my_dict, "dog", result);
    assert(result[0] == '\0'); // No autocomplete suggestions for "dog"
 
+   // Ties go to the word that comes first alphabetically ...
+   assert(dict_addword(my_dict, "parts"));
+   assert(dict_addword(my_dict, "par"));
+   dict_autocomplete(my_dict, "p", result);
+   assert(strcmp(result, "ar") == 0);
+   // ... but the cached best moves as soon as a word overtakes it
+   dict_addword(my_dict, "parts");
+   dict_autocomplete(my_dict, "p", result);
+   assert(strcmp(result, "arts") == 0);
+   // Nothing below a word that ends the tree
+   dict_autocomplete(my_dict, "parts", result);
+   assert(result[0] == '\0');
+
+   // Whole word files in one call
+   dict* w = dict_init();
+   int bad = -1;
+   assert(dict_load_file(w, "wordle.txt", &bad) == 2315);
+   assert(bad == 0);
+   assert(dict_nodecount(w) == 5640);
+   assert(dict_spell(w, "aback") && dict_spell(w, "zonal"));
+   assert(dict_load_file(w, "no-such-file.txt", &bad) == -1);
+   // Node distances through the index agree with dict_cmp's
+   dict_lca* lca = dict_lca_build(w);
+   dict* aback = dict_spell(w, "aback");
+   dict* zonal = dict_spell(w, "zonal");
+   assert(aback->depth == 5 && w->depth == 0);
+   assert(dict_cmp(aback, zonal) == 10 && dict_lca_cmp(lca, aback, zonal) == 10);
+   assert(dict_lca_cmp(lca, aback, aback) == 0 && dict_lca_cmp(lca, w, zonal) == 5);
+   assert(dict_lca_cmp(lca, aback->up->up, aback) == 2);
+   const char* near[] = {"abbey", "abbot", "zesty", "crane", "crank", "cramp"};
+   for (int i = 0; i < 6; i++) {
+      dict* a = dict_spell(w, near[i]);
+      for (int j = 0; j < 6; j++) {
+         dict* b = dict_spell(w, near[j])->up;
+         assert(dict_lca_cmp(lca, a, b) == dict_cmp(a, b));
+      }
+   }
+   dict_addword(w, "abacus"); // Not in the index
+   assert(dict_lca_cmp(lca, dict_spell(w, "abacus"), zonal) == 11);
+   assert(dict_lca_cmp(lca, dict_spell(w, "abacus"), aback) == 3);
+   dict_lca_free(&lca);
+   assert(!lca);
+   // Wordle clues, on the tree and through the index
+   dict_match_index* mx = dict_match_build(w, 5);
+   const char* notat[] = {"a", NULL, "", NULL, NULL};
+   dict_clues clues = {"stoin", "a", notat};
+   char matched[2][400];
+   for (int i = 0; i < 2; i++) {
+      matched[i][0] = '\0';
+   }
+   assert(dict_match(w, "?R??e", &clues, test_listword, matched[0]) == 13);
+   assert(dict_match_indexed(mx, "?R??e", &clues, test_listword, matched[1]) == 13);
+   assert(strncmp(matched[0], "brace:1 brake:1 brave:1 crave:1 craze:1 ", 40) == 0);
+   assert(strcmp(matched[0], matched[1]) == 0);
+   clues = (dict_clues){"e", NULL, NULL}; // The third e is grey
+   matched[0][0] = '\0';
+   assert(dict_match(w, "s?e?e", &clues, test_listword, matched[0]) == 3);
+   assert(strcmp(matched[0], "scene:1 siege:1 sieve:1 ") == 0);
+   int counted = 0;
+   assert(dict_match_indexed(mx, "s?e?e", &clues, test_countword, &counted) == 3);
+   clues = (dict_clues){"aeiou", NULL, NULL};
+   assert(dict_match(w, ".....", &clues, test_countword, &counted) == 13);
+   assert(dict_match_indexed(mx, ".....", &clues, test_countword, &counted) == 13);
+   notat[0] = "q";
+   clues = (dict_clues){NULL, "QU", notat};
+   assert(dict_match(w, "?????", &clues, test_countword, &counted) == 6);
+   assert(dict_match_indexed(mx, "?????", &clues, test_countword, &counted) == 6);
+   assert(counted == 3 + 13 + 13 + 6 + 6);
+   assert(dict_match(w, "?????", NULL, test_countword, &counted) == 2315);
+   assert(dict_match_indexed(mx, "?????", NULL, test_countword, &counted) == 2315);
+   assert(dict_match(w, "ab?c1", NULL, test_countword, &counted) == 0);
+   assert(dict_match_indexed(mx, "????", NULL, test_countword, &counted) == 0);
+   dict_match_free(&mx);
+   assert(!mx);
+   // Cursors list every word, and can be paused and picked up again
+   dict_cursor* all = dict_cursor_open(w, "");
+   dict_cursor* ab = dict_cursor_open(w, "AB");
+   const char* listw;
+   int freq;
+   char prev[WORD_MAXLEN + 1] = "";
+   int listed_words = 0;
+   counted = 0;
+   while (dict_cursor_next(all, &listw, &freq)) {
+      assert(strcmp(prev, listw) < 0);
+      strcpy(prev, listw);
+      listed_words++;
+      counted += freq;
+      if (listed_words == 1) {
+         assert(strcmp(listw, "aback") == 0);
+         assert(dict_cursor_next(ab, &listw, NULL) && strcmp(listw, "aback") == 0);
+      }
+   }
+   // The wordle words, and abacus
+   assert(listed_words == 2316 && counted == dict_wordcount(w) && strcmp(prev, "zonal") == 0);
+   assert(!dict_cursor_next(all, &listw, &freq));
+   assert(dict_cursor_next(ab, &listw, NULL) && strcmp(listw, "abacus") == 0);
+   dict_cursor_close(&all);
+   dict_cursor_close(&ab);
+   assert(!all);
+   dict* its = dict_init();
+   dict_addword(its, "it's");
+   dict_addword(its, "its");
+   dict_addword(its, "It");
+   dict_addword(its, "its");
+   all = dict_cursor_open(its, "i");
+   assert(dict_cursor_next(all, &listw, &freq) && strcmp(listw, "it") == 0 && freq == 1);
+   assert(dict_cursor_next(all, &listw, &freq) && strcmp(listw, "its") == 0 && freq == 2);
+   assert(dict_cursor_next(all, &listw, NULL) && strcmp(listw, "it's") == 0);
+   assert(!dict_cursor_next(all, &listw, NULL));
+   dict_cursor_close(&all);
+   all = dict_cursor_open(its, "i5");
+   assert(all && !dict_cursor_next(all, &listw, NULL));
+   dict_cursor_close(&all);
+   dict_free(&its);
+   dict_free(&w);
+
+   // The most frequent words, kept in order as they are counted
+   w = dict_init();
+   assert(dict_topn(w, 3, NULL, NULL) == 0);
+   assert(dict_load_file(w, "p-and-p-words.txt", NULL) > 0);
+   char freqbuf[100][WORD_MAXLEN + 1];
+   char* freqw[100];
+   int freqf[100];
+   for (int i = 0; i < 100; i++) {
+      freqw[i] = freqbuf[i];
+   }
+   assert(dict_topn(w, 100, freqw, freqf) == 100);
+   assert(freqf[0] == dict_mostcommon(w) && freqf[0] == 4331);
+   for (int i = 0; i < 100; i++) {
+      assert(dict_spell(w, freqw[i])->freq == freqf[i]);
+      assert(i == 0 || freqf[i] <= freqf[i - 1]);
+   }
+   // Suggestions: nearest first, then most frequent
+   assert(dict_suggest(w, "Elizabth", 2, 3, freqw) >= 1 && strcmp(freqw[0], "elizabeth") == 0);
+   assert(dict_suggest(w, "elizabeth", 0, 3, freqw) == 1);
+   assert(dict_suggest(w, "qqqqqqqq", 2, 3, freqw) == 0);
+   assert(dict_suggest(w, "th3", 2, 3, freqw) == 0);
+   dict_free(&w);
+   w = dict_init();
+   const char* spelt[] = {"cart", "card", "card", "care", "cat", "cast", "dog", "car", "carts"};
+   for (int i = 0; i < 9; i++) {
+      dict_addword(w, spelt[i]);
+   }
+   assert(dict_suggest(w, "cARx", 1, 10, freqw) == 4);
+   assert(strcmp(freqw[0], "card") == 0 && strcmp(freqw[1], "car") == 0);
+   assert(strcmp(freqw[2], "care") == 0 && strcmp(freqw[3], "cart") == 0);
+   assert(dict_suggest(w, "cart", 1, 2, freqw) == 2);
+   assert(strcmp(freqw[0], "cart") == 0 && strcmp(freqw[1], "card") == 0);
+   assert(dict_suggest(w, "cat", 2, 10, freqw) == 7); // All but dog
+   assert(dict_suggest(dict_spell(w, "car"), "ts", 0, 10, freqw) == 1);
+   assert(strcmp(freqw[0], "ts") == 0);
+   dict_free(&w);
+   w = dict_init();
+   const char* few[] = {"b", "a", "c", "b", "c", "c"};
+   dict* pw = dict_build_parallel(few, 6, 2);
+   for (int i = 0; i < 6; i++) {
+      dict_addword(w, few[i]);
+   }
+   for (dict* t = w; t; t = (t == w) ? pw : NULL) {
+      assert(dict_topn(dict_spell(t, "a"), 5, freqw, freqf) == 3);
+      assert(strcmp(freqw[0], "c") == 0 && strcmp(freqw[1], "b") == 0 && strcmp(freqw[2], "a") == 0);
+      assert(freqf[0] == 3 && freqf[1] == 2 && freqf[2] == 1);
+   }
+   dict_free(&pw);
+   dict_free(&w);
+   // Ranks too big for a node go to the side table, and come back
+   w = dict_init();
+   assert(dict_load_file(w, "wordle.txt", NULL) == 2315);
+   dict_hdr* rh = dict_header(w);
+   for (int i = 0; i < 500; i++) {
+      rank_set(rh, rh->order[i], (int)RANK_SPILL + i);
+   }
+   assert(rh->spilled == 500 && rank_get(rh, rh->order[499]) == (int)RANK_SPILL + 499);
+   for (int i = 0; i < 500; i += 2) {
+      rank_set(rh, rh->order[i], i);
+   }
+   assert(rh->spilled == 250);
+   for (int i = 0; i < 500; i++) {
+      assert(rank_get(rh, rh->order[i]) == (i % 2 ? (int)RANK_SPILL + i : i));
+   }
+   order_rebuild(rh);
+   assert(rh->spilled == 0);
+   for (int i = 0; i < rh->ordered; i++) {
+      assert(rank_get(rh, rh->order[i]) == i);
+   }
+   dict_free(&w);
+
+   // The whole-tree walks give the same on several threads as on one
+   w = dict_init();
+   assert(dict_load_file(w, "p-and-p-words.txt", NULL) > 0);
+   dict* tw = dict_child(w, 't' - 'a');
+   tree_stats st = stats_par(tw, 4);
+   assert(st.words == dict_wordcount(tw) && st.nodes == dict_nodecount(tw));
+   assert(st.maxfreq == dict_mostcommon(tw) && st.maxfreq == 4331);
+   st = stats_par(w, 3);
+   assert(st.words == dict_wordcount(w) && st.nodes == dict_nodecount(w));
+   dict_hdr* wh = (dict_hdr*)w;
+   int words_before = wh->words;
+   assert(dict_topn(w, 3, freqw, freqf) == 3);
+   wh->words = wh->maxfreq = wh->ordered = 0;
+   writer_sync_all(wh, 4);
+   order_rebuild(wh);
+   assert(wh->words == words_before && wh->maxfreq == 4331 && wh->ordered == wh->above[0]);
+   assert(dict_topn(w, 1, freqw + 1, freqf + 1) == 1 && strcmp(freqw[0], freqw[1]) == 0);
+   dict_autocomplete(w, "th", result);
+   assert(strcmp(result, "e") == 0);
+   dict_free(&w);
+
+   // Writers on several threads build what dict_addword would
+   char (*three)[4] = (char (*)[4])malloc(2000 * sizeof(*three));
+   assert(three);
+   for (int i = 0; i < 2000; i++) {
+      three[i][0] = (char)('a' + i / 676);
+      three[i][1] = (char)('a' + i / 26 % 26);
+      three[i][2] = (char)('a' + i % 26);
+      three[i][3] = '\0';
+   }
+   w = dict_init();
+   dict_addword(w, "baa");
+   dict_addword(w, "baa");
+   dict* cw = dict_init();
+   dict_addword(cw, "baa");
+   dict_addword(cw, "Baa");
+   pthread_t tid[4];
+   writer_test wt[4];
+   for (int t = 0; t < 4; t++) {
+      wt[t] = (writer_test){cw, three, 2000 - 500 * t, 397 * t};
+      assert(pthread_create(&tid[t], NULL, writer_test_run, &wt[t]) == 0);
+      for (int i = 0; i < wt[t].n; i++) {
+         dict_addword(w, three[(wt[t].from + i) % wt[t].n]);
+      }
+   }
+   for (int t = 0; t < 4; t++) {
+      pthread_join(tid[t], NULL);
+   }
+   assert(dict_nodecount(cw) == dict_nodecount(w));
+   assert(dict_wordcount(cw) == dict_wordcount(w) && dict_mostcommon(cw) == 5);
+   assert(dict_spell(cw, "baa")->freq == 5 && dict_spell(cw, "bzz")->freq == 2);
+   assert(dict_spell(cw, "cxz")->freq == 1 && !dict_spell(cw, "czz"));
+   dict_autocomplete(cw, "c", result);
+   assert(strcmp(result, "aa") == 0);
+   assert(dict_topn(cw, 1, freqw, freqf) == 1 && strcmp(freqw[0], "baa") == 0);
+   assert(dict_addword(cw, "czz") && dict_addword(cw, "zzzz"));
+   assert(dict_nodecount(cw) == dict_nodecount(w) + 6);
+   dict_free(&cw);
+   dict_free(&w);
+   free(three);
+
+   // Pinned versions stay as they were while words are added
+   dict_versioned* vd = dict_versioned_new();
+   assert(dict_versioned_add(vd, "cat") && !dict_versioned_add(vd, "Cat"));
+   assert(!dict_versioned_add(vd, "c4t") && !dict_versioned_add(vd, ""));
+   int ticket1, ticket2;
+   const dict* v1 = dict_versioned_pin(vd, &ticket1);
+   assert(dict_versioned_add(vd, "ca") && dict_versioned_add(vd, "cattle"));
+   assert(dict_versioned_add(vd, "dog"));
+   const dict* v2 = dict_versioned_pin(vd, &ticket2);
+   assert(ticket1 != ticket2);
+   assert(dict_wordcount(v1) == 2 && dict_nodecount(v1) == 4 && dict_mostcommon(v1) == 2);
+   assert(dict_spell(v1, "cat")->freq == 2 && !dict_spell(v1, "ca") && !dict_spell(v1, "dog"));
+   assert(dict_wordcount(v2) == 5 && dict_nodecount(v2) == 10);
+   assert(dict_spell(v2, "ca") && dict_spell(v2, "cattle")->freq == 1);
+   dict_autocomplete(v2, "c", result);
+   assert(strcmp(result, "at") == 0);
+   dict_autocomplete(v1, "ca", result);
+   assert(strcmp(result, "t") == 0);
+   dict_versioned_unpin(vd, ticket1);
+   dict_versioned_unpin(vd, ticket2);
+   // Counts below a version's top only look down: "ca" is shared, its 'up' long freed
+   assert(dict_versioned_add(vd, "cow"));
+   v2 = dict_versioned_pin(vd, &ticket2);
+   const dict* ca = dict_spell(v2, "ca");
+   assert(dict_wordcount(ca) == 4 && dict_nodecount(ca) == 5 && dict_mostcommon(ca) == 2);
+   dict_versioned_unpin(vd, ticket2);
+   dict_versioned_free(&vd);
+   assert(!vd);
+   three = (char (*)[4])malloc(2000 * sizeof(*three));
+   assert(three);
+   for (int i = 0; i < 2000; i++) {
+      three[i][0] = (char)('a' + i / 676);
+      three[i][1] = (char)('a' + i / 26 % 26);
+      three[i][2] = (char)('a' + i % 26);
+      three[i][3] = '\0';
+   }
+   vd = dict_versioned_new();
+   w = dict_init();
+   for (int i = 0; i < 3; i++) {
+      dict_versioned_add(vd, "baa");
+      dict_addword(w, "baa");
+   }
+   vers_test vt[2] = {{vd, 0, 0}, {vd, 0, 0}};
+   for (int t = 0; t < 2; t++) {
+      assert(pthread_create(&tid[t], NULL, vers_test_run, &vt[t]) == 0);
+   }
+   for (int i = 0; i < 2000; i++) {
+      dict_versioned_add(vd, three[(i * 7) % 2000]);
+      dict_addword(w, three[(i * 7) % 2000]);
+   }
+   for (int t = 0; t < 2; t++) {
+      ATOMIC_STORE(&vt[t].done, 1);
+      pthread_join(tid[t], NULL);
+   }
+   const dict* last = dict_versioned_pin(vd, &ticket1);
+   assert(dict_nodecount(last) == dict_nodecount(w) && dict_wordcount(last) == 2003);
+   assert(dict_mostcommon(last) == 4 && dict_spell(last, "cxx")->freq == 1);
+   dict_versioned_unpin(vd, ticket1);
+   dict_versioned_free(&vd);
+   dict_free(&w);
+   free(three);
+
+   // A word is checked whole before anything is added
+   w = dict_init();
+   assert(!dict_addword(w, "cart9") && !dict_addword(w, "ca-rt"));
+   assert(dict_nodecount(w) == 1);
+   char longest[WORD_MAXLEN + 2];
+   memset(longest, 'Q', WORD_MAXLEN + 1);
+   longest[WORD_MAXLEN + 1] = '\0';
+   assert(!dict_addword(w, longest)); // One letter too many
+   longest[WORD_MAXLEN] = '\0';
+   assert(dict_addword(w, longest) && dict_nodecount(w) == WORD_MAXLEN + 1);
+   longest[WORD_MAXLEN - 1] = '2';
+   assert(!dict_spell(w, longest));
+   // Below another node, no word may end deeper than that either
+   longest[WORD_MAXLEN - 1] = 'Q';
+   dict* deepest = dict_spell(w, longest);
+   const char* oneq[] = {"q"};
+   assert(!dict_addword(deepest, "q") && !dict_addword(deepest, longest));
+   assert(dict_addsorted(deepest, oneq, 1) == 0);
+   dict_writer* dw = dict_writer_new(deepest);
+   assert(!dict_writer_add(dw, "q"));
+   dict_writer_free(&dw);
+   assert(dict_addword(deepest->up, "a") && !dict_addword(deepest->up, "ab"));
+   assert(dict_nodecount(w) == WORD_MAXLEN + 2);
+   assert(dict_cmp(deepest, w) == WORD_MAXLEN);
+   assert(dict_cmp(deepest, dict_spell(deepest->up, "a")) == 2);
+   // So the deepest words still fit the fixed-size buffers
+   char deepbuf[2][WORD_MAXLEN + 1];
+   char* deepw[2] = {deepbuf[0], deepbuf[1]};
+   assert(dict_topn(w, 2, deepw, NULL) == 2);
+   assert(strlen(deepw[0]) == WORD_MAXLEN && strlen(deepw[1]) == WORD_MAXLEN);
+   assert(dict_autocomplete_topk(w, "", 2, deepw) == 2);
+   assert(deepw[0][WORD_MAXLEN - 1] == 'a' && deepw[1][WORD_MAXLEN - 1] == 'q');
+   dict_cursor* deepc = dict_cursor_open(w, "");
+   const char* deepword;
+   assert(dict_cursor_next(deepc, &deepword, NULL) && strcmp(deepword, deepw[0]) == 0);
+   assert(dict_cursor_next(deepc, &deepword, NULL) && strcmp(deepword, deepw[1]) == 0);
+   assert(!dict_cursor_next(deepc, &deepword, NULL));
+   dict_cursor_close(&deepc);
+   dict_free(&w);
+   char low[WORD_MAXLEN + 1];
+   unsigned char slots[WORD_MAXLEN + 1];
+   const char* mixed = "AbCdEfGhIjKlMnOpQrStUvWxYz'AbCdEfGhIj";
+   assert(norm_word(mixed, strlen(mixed), low, slots));
+   assert(strcmp(low, "abcdefghijklmnopqrstuvwxyz'abcdefghij") == 0);
+   assert(slots[0] == 0 && slots[25] == 25 && slots[26] == 26 && slots[36] == 9);
+   assert(!norm_word("abcdefghijklmnopqrstuvwxyz'abc\xe9", 31, NULL, NULL));
+   assert(!norm_word("ab@", 3, NULL, NULL) && !norm_word("ab[", 3, NULL, NULL));
+   assert(!norm_word("", 0, low, NULL) && word_slot('`') < 0 && word_slot('Z') == 25);
+
+   // A parallel build gives the same tree as adding one by one
+   const char* many[] = {"cart", "Car", "part", "car", "'tis", "parted", "cart'd", "ab1", "7up", "", "zed", "car"};
+   int nmany = (int)(sizeof(many) / sizeof(many[0]));
+   w = dict_init();
+   for (int i = 0; i < nmany; i++) {
+      dict_addword(w, many[i]);
+   }
+   for (int t = 1; t <= 4; t += 3) {
+      dict* pw = dict_build_parallel(many, nmany, t);
+      assert(dict_nodecount(pw) == dict_nodecount(w));
+      assert(dict_wordcount(pw) == dict_wordcount(w));
+      assert(dict_mostcommon(pw) == 3);
+      assert(dict_spell(pw, "car")->freq == 3);
+      assert(dict_spell(pw, "cart'd") && dict_spell(pw, "'tis"));
+      assert(dict_spell(pw, "ab") == NULL);
+      assert(dict_cmp(dict_spell(pw, "zed"), dict_spell(pw, "car")) == 6);
+      dict_autocomplete(pw, "", result);
+      assert(strcmp(result, "car") == 0);
+      dict_free(&pw);
+   }
+   dict_free(&w);
+
+   // Sorted input resumes from the previous word; unsorted still works
+   const char* sorted[] = {"a", "Aa", "aaa", "aback", "abacus", "abacus", "he'd", "head", "head", "ab", "zz9", "zzz"};
+   int nsorted = (int)(sizeof(sorted) / sizeof(sorted[0]));
+   w = dict_init();
+   dict* sw = dict_init();
+   for (int i = 0; i < nsorted; i++) {
+      dict_addword(w, sorted[i]);
+   }
+   assert(dict_addsorted(sw, sorted, nsorted) == nsorted - 1);
+   assert(dict_nodecount(sw) == dict_nodecount(w));
+   assert(dict_wordcount(sw) == dict_wordcount(w));
+   assert(dict_mostcommon(sw) == 2);
+   assert(dict_spell(sw, "head")->freq == 2 && dict_spell(sw, "ab"));
+   assert(dict_spell(sw, "zz") == NULL && dict_spell(sw, "zzz"));
+   dict_autocomplete(sw, "h", result);
+   assert(strcmp(result, "ead") == 0);
+   dict_free(&sw);
+   dict_free(&w);
+
+   // Frozen: the endings of cat/cats and bat/bats are stored once
+   w = dict_init();
+   dict_addword(w, "cat");
+   dict_addword(w, "cats");
+   dict_addword(w, "bat");
+   dict_addword(w, "bats");
+   dict_addword(w, "Cats");
+   dict_frozen* fz = dict_freeze(w);
+   assert(dict_nodecount(w) == 9);
+   assert(dict_frozen_nodecount(fz) == 5);
+   assert(dict_frozen_spell(fz, "bat") && dict_frozen_spell(fz, "CAT"));
+   assert(!dict_frozen_spell(fz, "ca") && !dict_frozen_spell(fz, "catss"));
+   assert(dict_frozen_freq(fz, "cats") == 2 && dict_frozen_freq(fz, "bats") == 1);
+   char listed[64] = "";
+   assert(dict_frozen_prefix(fz, "Ca", test_listword, listed) == 2);
+   assert(strcmp(listed, "cat:1 cats:2 ") == 0);
+   dict_frozen_free(&fz);
+   assert(fz == NULL);
+   dict_free(&w);
+
+   // A saved snapshot answers the same queries straight from the file
+   char img[] = "/tmp/t27_testXXXXXX";
+   int imgfd = mkstemp(img);
+   assert(imgfd != -1 && close(imgfd) == 0);
+   w = dict_init();
+   dict_addword(w, "carted");
+   dict_addword(w, "carter");
+   dict_addword(w, "carted");
+   dict_addword(w, "cart'd");
+   assert(dict_save(w, img));
+   dict_free(&w);
+   dict_mapped* mp = dict_open_mapped(img);
+   assert(mp);
+   assert(dict_mapped_spell(mp, "Carter") && !dict_mapped_spell(mp, "cart"));
+   assert(dict_mapped_freq(mp, "carted") == 2 && dict_mapped_freq(mp, "carts") == 0);
+   assert(dict_mapped_wordcount(mp) == 4);
+   dict_mapped_autocomplete(mp, "c", result);
+   assert(strcmp(result, "arted") == 0);
+   dict_mapped_autocomplete(mp, "x", result);
+   assert(result[0] == '\0');
+   dict_mapped_close(&mp);
+   assert(mp == NULL);
+   // A damaged file may answer wrongly, but is never read outside itself
+   FILE* imgfp = fopen(img, "r+b");
+   assert(imgfp && fseek(imgfp, (long)sizeof(image_hdr), SEEK_SET) == 0);
+   for (uint32_t i = 0; i < 10; i++) {
+      image_node bad_node = {0x7FFFFFFu, i % 3 ? i : 0xFFFFFFF0u, i * 7 % 20, 1};
+      assert(fwrite(&bad_node, sizeof(bad_node), 1, imgfp) == 1);
+   }
+   assert(fclose(imgfp) == 0);
+   mp = dict_open_mapped(img);
+   assert(mp);
+   dict_mapped_freq(mp, "carted");
+   dict_mapped_freq(mp, "zzzzzzzzzzzz");
+   dict_mapped_autocomplete(mp, "", result);
+   dict_mapped_autocomplete(mp, "b", result);
+   assert(strlen(result) <= WORD_MAXLEN);
+   dict_mapped_close(&mp);
+   assert(unlink(img) == 0);
+   assert(dict_open_mapped(img) == NULL);
+
+   // Double-array copy: same words, same counts
+   w = dict_init();
+   dict_addword(w, "cart");
+   dict_addword(w, "cart'd");
+   dict_addword(w, "zoo");
+   dict_addword(w, "Cart");
+   dict_da* da = dict_da_build(w);
+   assert(dict_da_nodecount(da) == dict_nodecount(w));
+   assert(dict_da_freq(da, "CART") == 2 && dict_da_freq(da, "cart'd") == 1);
+   assert(dict_da_spell(da, "zoo") && !dict_da_spell(da, "zo") && !dict_da_spell(da, "zoos"));
+   assert(!dict_da_spell(da, "c4rt") && !dict_da_spell(da, ""));
+   dict_da_free(&da);
+   assert(da == NULL);
+   dict_free(&w);
+
+   // Batched lookups give what one-by-one lookups give
+   w = dict_init();
+   dict_addword(w, "cart");
+   dict_addword(w, "carts");
+   dict_addword(w, "ca'");
+   const char* look[] = {"cart", "car", NULL, "", "Carts", "ca'", "cat", "c4rt", "carts", "cartsx"};
+   int nlook = (int)(sizeof(look) / sizeof(look[0]));
+   dict* got[10];
+   dict_spell_batch(w, look, nlook, got);
+   for (int i = 0; i < nlook; i++) {
+      assert(got[i] == dict_spell(w, look[i]));
+   }
+   dict_free(&w);
+
+   // Ranked completions: parts(2), then par, part, parts' (all 1)
+   dict_addword(my_dict, "parts'");
+   char topbuf[4][256];
+   char* top[4] = {topbuf[0], topbuf[1], topbuf[2], topbuf[3]};
+   assert(dict_autocomplete_topk(my_dict, "p", 4, top) == 4);
+   assert(strcmp(top[0], "arts") == 0);
+   assert(strcmp(top[1], "ar") == 0);
+   assert(strcmp(top[2], "art") == 0);
+   assert(strcmp(top[3], "arts'") == 0);
+   // Fewer words than asked for
+   assert(dict_autocomplete_topk(my_dict, "c", 4, top) == 2);
+   assert(strcmp(top[0], "ar") == 0 && strcmp(top[1], "art") == 0);
+   assert(dict_autocomplete_topk(my_dict, "dog", 4, top) == 0);
+
    // Free the dictionary
    dict_free(&my_dict);
    assert(my_dict == NULL);
+
+   // Reserved nodes come from one slab, and behave as usual
+   my_dict = dict_init();
+   dict_reserve(my_dict, 10000);
+   assert(dict_addword(my_dict, "reserve"));
+   assert(dict_nodecount(my_dict) == 8);
+   // Freeing a node below the top only drops the pointer
+   found = dict_spell(my_dict, "reserve");
+   dict_free(&found);
+   assert(found == NULL && dict_spell(my_dict, "reserve"));
+   dict_free(&my_dict);
+   assert(my_dict == NULL);
+
+   // Children added out of order, growing a block from 1 to 27 slots
+   my_dict = dict_init();
+   const char* order = "qz'amxbyclwdkveujftignshorp";
+   for (int i = 0; order[i]; i++) {
+      char wd[3] = {'x', order[i], '\0'};
+      assert(dict_addword(my_dict, wd));
+   }
+   for (int i = 0; order[i]; i++) {
+      char wd[3] = {'X', order[i], '\0'};
+      assert(dict_spell(my_dict, wd));
+   }
+   assert(dict_spell(my_dict, "x") == NULL);
+   assert(dict_nodecount(my_dict) == 29);
+   dict_autocomplete(my_dict, "x", result);
+   assert(strcmp(result, "a") == 0);
+   dict_free(&my_dict);
 }
@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
 
 // 26 letters, plus the '
 #define ALPHA 27
@@ -16,32 +17,91 @@
 // to the user, and it's members should *never*
 // be used in e.g. driver.c
 struct dict {
-   // 'Down' pointers next letter of word a-z or '
-   struct dict* dwn[ALPHA];
+   /* 'Down' pointers to the next letter of word
+      a-z or ', stored sparsely: only the children
+      that exist, found through a bitmap of letters.
+      NULL if this node has no children. With
+      the order dict_topn keeps (a pointer per
+      word), english_65197.txt takes 7.87 MiB,
+      against 36.98 MiB with 27 pointers a node:
+      4.7x less (5x before dict_topn). */
+   struct dict_kids* dwn;
    /* The parent pointer, useful for
       traversing back up the tree */
    struct dict* up; 
    // Is this node the end of a word?
-   bool terminal;
+   bool terminal : 1;
+   // Letters from the top node (which is 0)
+   unsigned int depth : 8;
+   /* Place of this word in its dictionary's
+      most-frequent-first order (terminals only),
+      if it fits; larger ones are kept aside */
+   unsigned int rank : 23;
    // Store occurences of the *same* word
    // Only used in terminal nodes
    int freq;
+   /* The most frequent word at or below this
+      node (ties go to the first alphabetically),
+      kept up to date by dict_addword. NULL if
+      no word passes through here. */
+   struct dict* best;
 };
 typedef struct dict dict;
 
 // Creates new dictionary
 dict* dict_init(void);
 
+/* Hint that about n more nodes are about
+   to be added below p, so they can all be
+   carved from one slab of the arena. */
+void dict_reserve(dict* p, int n);
+
 /* Top of Dictionary = p,
    add word str. Return false
-   if p or str is NULL, or if word
-   is already in the dictionary.
+   if p or str is NULL, if word
+   is already in the dictionary, or
+   if it isn't a word: 1 to 255
+   letters or ', in either case, and
+   ending at most 255 letters below the
+   top node (then nothing is added).
    True otherwise.
 */
 bool dict_addword(dict* p, const char* wd);
 
+/* Adds every word of file 'fname' to p.
+   Words are separated by any whitespace; one
+   dict_addword would refuse (a character
+   other than a letter or ', or too long) is
+   skipped and counted in 'rejected' (if not
+   NULL). Returns the number of words added
+   (repeats included) or -1 if the file
+   can't be read. */
+int dict_load_file(dict* p, const char* fname, int* rejected);
+
+/* Builds a new dictionary from words[0..n)
+   on up to 'nthreads' threads, each building
+   the subtrees of whole first letters. The
+   result is the same as adding the words one
+   at a time with dict_addword. */
+dict* dict_build_parallel(const char* const* words, int n, int nthreads);
+
+/* Adds words[0..n), which should be sorted
+   (ignoring case): each word carries on from
+   where it parts from the one before, not
+   from the top. Words out of order are still
+   added, from the top. Returns the number of
+   words added (repeats included). */
+int dict_addsorted(dict* p, const char* const* words, int n);
+
 /* The total number of nodes
-   in the tree. */
+   in the tree. Constant time for the
+   top node, which keeps running totals
+   (as do dict_wordcount and
+   dict_mostcommon). Below the top, all
+   three walk the subtree; for a node one
+   or two letters down whose subtree has
+   over 65,536 nodes, the walk is split
+   over up to 8 threads (one per CPU). */
 int dict_nodecount(const dict* p);
 
 /* Total number of times that any words
@@ -54,8 +114,19 @@ int dict_wordcount(const dict* p);
 */
 dict* dict_spell(const dict* p, const char* str);
 
+/* dict_spell for each of words[0..n), into
+   results[0..n). Many lookups are advanced
+   together so their memory waits overlap.
+   That only pays when the tree is much bigger
+   than the cache; on the bundled word files,
+   which fit, it is a little slower than a
+   loop of dict_spell. */
+void dict_spell_batch(const dict* p, const char* const* words, int n, dict** results);
+
 /* Frees all memory used by dictionary p.
-   Sets the original pointer back to NULL */
+   Sets the original pointer back to NULL.
+   Nodes live in their dictionary's arena,
+   so only the top node frees anything. */
 void dict_free(dict** p);
 
 /* Returns number of times most common
@@ -69,13 +140,207 @@ int dict_mostcommon(const dict* p);
    For two nodes, count the nodes that separate them */
 unsigned dict_cmp(dict* p1, dict* p2);
 
+/* An index of the finished tree at or below
+   p, for millions of dict_cmp: with it,
+   dict_lca_cmp(x, p1, p2) gives dict_cmp(p1,
+   p2) in constant time. Nodes added since it
+   was built are not in it, and fall back to
+   dict_cmp. Free it before the dictionary. */
+typedef struct dict_lca dict_lca;
+dict_lca* dict_lca_build(const dict* p);
+unsigned dict_lca_cmp(const dict_lca* x, const dict* p1, const dict* p2);
+void dict_lca_free(dict_lca** x);
+
 /* CHALLENGE2
    For dictionary 'p', and word 'wd', find the
    path down to the most frequently used word
    below this node, adding these letters to 'ret'.
    In the event of ties, use the word that comes
    first alphabetically. Treat the apostrophe as
-   alphabetically greater than all letters */
+   alphabetically greater than all letters.
+   Runs in time proportional to the length of
+   'wd' plus the letters written to 'ret'. */
 void dict_autocomplete(const dict* p, const char* wd, char* ret);
 
+/* For adding words from many threads at
+   once: each thread opens its own writer on
+   p's dictionary and adds through it. Until
+   the last writer is freed, nothing but the
+   writers may use the dictionary; then it is
+   as if the words had been added one by one
+   with dict_addword (to the node given). */
+typedef struct dict_writer dict_writer;
+dict_writer* dict_writer_new(dict* p);
+// As dict_addword, through writer w
+bool dict_writer_add(dict_writer* w, const char* wd);
+void dict_writer_free(dict_writer** w);
+
+/* A dictionary readers can use while words
+   are being added, without waiting for the
+   writers: a reader pins the current version
+   and sees it just as it was, whatever is
+   added until it unpins. Writers take turns. */
+typedef struct dict_versioned dict_versioned;
+dict_versioned* dict_versioned_new(void);
+// As dict_addword, making a new version
+bool dict_versioned_add(dict_versioned* v, const char* wd);
+/* Pins the current version, returning its top
+   node for dict_spell, dict_autocomplete,
+   dict_wordcount, dict_nodecount and
+   dict_mostcommon (and nothing else). It is
+   good until unpinned with the same ticket.
+   At most 64 pins can be held at once: one
+   more spins (yielding the CPU) until some
+   other reader unpins. */
+const dict* dict_versioned_pin(dict_versioned* v, int* ticket);
+void dict_versioned_unpin(dict_versioned* v, int ticket);
+// Frees v, with nothing pinned, setting it back to NULL
+void dict_versioned_free(dict_versioned** v);
+
+/* The n most frequent words of the whole
+   dictionary p belongs to, most frequent
+   first (ties in no set order), copied into
+   the caller's buffers out_words[i] (each of
+   at least 256 chars) with their counts in
+   out_freqs[i]; either array may be NULL.
+   Returns how many there were, up to n.
+   Takes time in n, not in the dictionary. */
+int dict_topn(const dict* p, int n, char* out_words[], int out_freqs[]);
+
+/* The k best completions of 'wd', ranked as
+   dict_autocomplete ranks them (so ret[0] is
+   what dict_autocomplete gives). Each ret[i]
+   is a caller-provided buffer (of at least
+   256 chars) for the extra letters. Returns
+   how many were found. */
+int dict_autocomplete_topk(const dict* p, const char* wd, int k, char* ret[]);
+
+/* Spelling suggestions: the k words at or
+   below p within max_dist edits of 'wd' (a
+   letter added, dropped or changed), nearest
+   first and then most frequent, copied into
+   the caller's buffers out[i] (each of at
+   least 256 chars). Returns how many there
+   were, up to k. */
+int dict_suggest(const dict* p, const char* wd, int max_dist, int k, char* out[]);
+
+/* Clues for dict_match, as Wordle gives them.
+   Any of them may be NULL. */
+typedef struct dict_clues {
+   const char* absent;         // Letters not in the word (grey)
+   const char* present;        // Letters somewhere in it (yellow)
+   const char* const* not_at;  // not_at[i]: letters not at position i
+} dict_clues;
+
+/* Calls cb, in dictionary order, for every
+   word at or below p that fits 'pattern' (a
+   letter or ' where the word has that one,
+   '?' or '.' where it may have any) and the
+   clues. Returns the number of words listed. */
+int dict_match(const dict* p, const char* pattern, const dict_clues* clues,
+               void (*cb)(const char* wd, int freq, void* arg), void* arg);
+
+/* A frozen index of the words of length 'len'
+   at or below p, by letter and position, for
+   many dict_match queries: each is a few ANDs
+   of bitsets over the words. Later additions
+   to p are not in it. */
+typedef struct dict_match_index dict_match_index;
+dict_match_index* dict_match_build(const dict* p, int len);
+// As dict_match, through the index
+int dict_match_indexed(const dict_match_index* x, const char* pattern, const dict_clues* clues,
+                       void (*cb)(const char* wd, int freq, void* arg), void* arg);
+// Frees x, setting it back to NULL
+void dict_match_free(dict_match_index** x);
+
+/* Lists the words starting with 'prefix' (which
+   may be "") at or below p, one per call of
+   dict_cursor_next, in dictionary order. Each
+   word is given whole, prefix included, in the
+   cursor's own buffer, good until the next
+   call; freq gets its count (either may be
+   NULL). False once there are none left. A
+   cursor can be left and come back to at any
+   time, as long as p isn't changed meanwhile.
+   Only opening allocates anything. */
+typedef struct dict_cursor dict_cursor;
+dict_cursor* dict_cursor_open(const dict* p, const char* prefix);
+bool dict_cursor_next(dict_cursor* c, const char** wd, int* freq);
+// Frees c, setting it back to NULL
+void dict_cursor_close(dict_cursor** c);
+
+/* A frozen, read-only copy of a dictionary,
+   with words that end the same way sharing
+   their endings. Much smaller than the tree
+   it came from, which can then be freed. */
+typedef struct dict_frozen dict_frozen;
+
+// Freezes the words at or below p
+dict_frozen* dict_freeze(const dict* p);
+
+/* Times word 'wd' was added to the frozen
+   dictionary (0 if it isn't a word there),
+   and whether it is there at all. */
+int dict_frozen_freq(const dict_frozen* f, const char* wd);
+bool dict_frozen_spell(const dict_frozen* f, const char* wd);
+
+// Nodes left after merging shared endings
+int dict_frozen_nodecount(const dict_frozen* f);
+
+/* Calls cb for every word starting with 'wd',
+   in dictionary order, with its frequency.
+   Returns the number of words listed. */
+int dict_frozen_prefix(const dict_frozen* f, const char* wd,
+                       void (*cb)(const char* wd, int freq, void* arg), void* arg);
+
+// Frees f, setting it back to NULL
+void dict_frozen_free(dict_frozen** f);
+
+/* Writes dictionary p to file 'fname' as a
+   binary snapshot. False if it can't. */
+bool dict_save(const dict* p, const char* fname);
+
+/* A snapshot mapped read-only into memory:
+   opening it costs the same however big it
+   is, and processes mapping the same file
+   share one copy. NULL if 'fname' isn't a
+   snapshot written by dict_save. Only the
+   header is checked then; a damaged file
+   can give wrong answers, but every node
+   number is checked as it is read, so it
+   is never read outside the file. */
+typedef struct dict_mapped dict_mapped;
+dict_mapped* dict_open_mapped(const char* fname);
+
+/* As dict_spell, dict_wordcount and
+   dict_autocomplete, but on a snapshot;
+   dict_mapped_freq gives a word's count. */
+int dict_mapped_freq(const dict_mapped* m, const char* wd);
+bool dict_mapped_spell(const dict_mapped* m, const char* wd);
+int dict_mapped_wordcount(const dict_mapped* m);
+void dict_mapped_autocomplete(const dict_mapped* m, const char* wd, char* ret);
+
+// Unmaps m, setting it back to NULL
+void dict_mapped_close(dict_mapped** m);
+
+/* A read-only double-array copy of a
+   dictionary, for the fastest dict_spell:
+   two array reads per letter. */
+typedef struct dict_da dict_da;
+
+// Builds the double array for the words at or below p
+dict_da* dict_da_build(const dict* p);
+
+/* Times word 'wd' was added (0 if it
+   isn't a word), and whether it is one. */
+int dict_da_freq(const dict_da* a, const char* wd);
+bool dict_da_spell(const dict_da* a, const char* wd);
+
+// Nodes of the tree it was built from, and bytes used
+int dict_da_nodecount(const dict_da* a);
+size_t dict_da_bytes(const dict_da* a);
+
+// Frees a, setting it back to NULL
+void dict_da_free(dict_da** a);
+
 void test(void);